@@ -7,71 +7,295 @@
 #define inline __inline
 #define vsnprintf _vsnprintf
 typedef unsigned char uint8_t;
+typedef unsigned short uint16_t;
+typedef unsigned int uint32_t;
 #else
 #include <stdbool.h>
 #include <stdint.h>
 #endif
 
-#include <ctype.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Vectorized whitespace skipping in the lexer. Set to 0 to use only the
+// scalar table-driven loops
+#ifndef ANT_SIMD
+#if defined(__SSE2__) && defined(__GNUC__)
+#define ANT_SIMD 1
+#else
+#define ANT_SIMD 0
+#endif
+#endif
+// Parse 8 decimal digits at a time with 64-bit arithmetic. Needs a little
+// endian target with a 64-bit long
+#ifndef ANT_SWAR
+#if ULONG_MAX > 0xffffffffUL && defined(__BYTE_ORDER__) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define ANT_SWAR 1
+#else
+#define ANT_SWAR 0
+#endif
+#endif
+
+#if ANT_SIMD && defined(__AVX2__)
+#include <immintrin.h>
+#elif ANT_SIMD
+#include <emmintrin.h>
+#endif
+
 typedef long antval_t;
 
+// Number of pre-resolved jumps per script, at most 255, set to 0 to save RAM
+#ifndef ANT_JUMPS
+#define ANT_JUMPS 8
+#endif
+
+// Number of ant3 variables, at most 220, so that ant5 register numbers,
+// which follow the variables, fit a byte. ant_compile() assigns variables to
+// slots in order of appearance, so this can be set to the number of
+// variables that scripts use. ant2_compile() uses slots 'a' to 'z'
+#ifndef ANT3_VARS
+#define ANT3_VARS ('z' - 'a' + 1)
+#endif
+#if ANT3_VARS > 220
+#error "ANT3_VARS must be at most 220, ant5 registers are 8-bit"
+#endif
+
+// Number of ant3 script functions, and how deep their calls can nest. Each
+// nesting level takes one return address on the evaluator's frame stack
+#ifndef ANT3_FUNCS
+#define ANT3_FUNCS 16
+#endif
+#ifndef ANT3_FRAMES
+#define ANT3_FRAMES 8
+#endif
+
+// Largest ant3 bytecode, in bytes, that the rewriting passes and ant3_jit()
+// handle, at most 32768, so that the rel16 of JumpL reaches any offset. A
+// rewriting pass keeps a jump target bitmap and an offset map of that size
+// on the stack, and ant3_optimize() a copy of the code, so AVR boards with
+// 2 KB of RAM get a small default
+#ifndef ANT3_CODE
+#if defined(__AVR__)
+#define ANT3_CODE 256
+#else
+#define ANT3_CODE 16384
+#endif
+#endif
+#if ANT3_CODE > 32768
+#error "ANT3_CODE must be at most 32768, JumpL has a 16-bit offset"
+#endif
+
+// Opcode profiler, see ant3_prof_dump(). When 1, ant3_eval() and
+// ant3_eval2() count instructions into ant3::prof, if it is set. When 0,
+// the dispatch loops are the same as without a profiler
+#ifndef ANT3_PROFILE
+#define ANT3_PROFILE 0
+#endif
+
+// Sampling profiler, see ant3_sample_start(). When 1, ant3_eval() keeps its
+// current instruction where a SIGPROF timer handler can read it, while the
+// sampler runs. Needs POSIX.1-2001 signals and timers: it is turned off if
+// the C library does not define _POSIX_C_SOURCE to 200112L or later. macOS
+// has them, but defines _POSIX_C_SOURCE only on request, so it is let through
+#ifndef ANT3_SAMPLE
+#define ANT3_SAMPLE 0
+#endif
+#if ANT3_SAMPLE && !defined(__APPLE__) && \
+    !(defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200112L)
+#undef ANT3_SAMPLE
+#define ANT3_SAMPLE 0
+#endif
+#if ANT3_SAMPLE
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
 struct ant {
   const char *buf, *pc, *eof;
-  int tok;                   // Parsed token
-  antval_t val;              // Parsed value
-  antval_t vars['z' - 'a'];  // Variables
-  char err[20];              // Error message
+  int tok;                       // Parsed token
+  antval_t val;                  // Parsed value
+  antval_t vars['z' - 'a' + 1];  // Variables
+  char err[20];                  // Error message
+#if ANT_JUMPS > 0
+  const char *jumps[ANT_JUMPS][2];  // Jump table: '@' position, destination
+  uint8_t sites[ANT_JUMPS];  // Number of '@' before a destination, at most 255
+  int njumps;                // Number of entries in the jump table
+  int site;                  // Index of the next '@' to run
+#endif
 };
+#if ANT_JUMPS > 0
+#define ANT_INITIALIZER \
+  { 0, 0, 0, 0, 0, {0}, "", {{0, 0}}, {0}, 0, 0 }
+#else
 #define ANT_INITIALIZER \
   { 0, 0, 0, 0, 0, {0}, "" }
+#endif
 enum { Inv, Eof, Num, Var, Inc, Dec, Eq };  // Tokens
 
+// Character classes of the shared lexer, see ant_ctype[]
+enum {
+  ANT_CSPACE = 1,   // Whitespace, as isspace() in the C locale
+  ANT_CDIGIT = 2,   // Decimal digit
+  ANT_CLOWER = 4,   // Lowercase letter
+  ANT_CIDENT = 8,   // Letter, digit or '_'
+  ANT_CHEX = 16,    // Hexadecimal digit
+  ANT_CSTART = 32,  // Letter or '_', starts an identifier
+};
+
+// Class bits of each byte. Bytes 128 to 255 have no class
+static const uint8_t ant_ctype[256] = {
+  // clang-format off
+   0,  0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,  1,  0,  0,
+   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+   1,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+  26, 26, 26, 26, 26, 26, 26, 26, 26, 26,  0,  0,  0,  0,  0,  0,
+   0, 56, 56, 56, 56, 56, 56, 40, 40, 40, 40, 40, 40, 40, 40, 40,
+  40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40,  0,  0,  0,  0, 40,
+   0, 60, 60, 60, 60, 60, 60, 44, 44, 44, 44, 44, 44, 44, 44, 44,
+  44, 44, 44, 44, 44, 44, 44, 44, 44, 44, 44,  0,  0,  0,  0,  0,
+  // clang-format on
+};
+
+static inline int ant_is(int ch, int cls) {
+  return ant_ctype[(uint8_t) ch] & cls;
+}
+
+// Skip bytes that equal `c` or lie in the range [lo, lo + n], a vector at a
+// time, while a whole vector fits before `eof`. Stop at the first other byte
+static inline const char *ant_simd_skip(const char *s, const char *eof,
+                                        int c, int lo, int n) {
+#if ANT_SIMD && defined(__AVX2__)
+  while (eof - s >= 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) s);
+    __m256i r = _mm256_sub_epi8(v, _mm256_set1_epi8((char) lo));
+    __m256i m = _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char) c));
+    r = _mm256_subs_epu8(r, _mm256_set1_epi8((char) n));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(r, _mm256_setzero_si256()));
+    unsigned mask = ~(unsigned) _mm256_movemask_epi8(m);
+    if (mask != 0) return s + __builtin_ctz(mask);
+    s += 32;
+  }
+#endif
+#if ANT_SIMD
+  while (eof - s >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) s);
+    __m128i r = _mm_sub_epi8(v, _mm_set1_epi8((char) lo));
+    __m128i m = _mm_cmpeq_epi8(v, _mm_set1_epi8((char) c));
+    r = _mm_subs_epu8(r, _mm_set1_epi8((char) n));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(r, _mm_setzero_si128()));
+    unsigned mask = (unsigned) _mm_movemask_epi8(m) ^ 0xffffU;
+    if (mask != 0) return s + __builtin_ctz(mask);
+    s += 16;
+  }
+#endif
+  (void) eof, (void) c, (void) lo, (void) n;
+  return s;
+}
+
+// Return the first non-whitespace byte at or after `s`, or `eof`
+static inline const char *ant_skip_space(const char *s, const char *eof) {
+  if (s >= eof || !ant_is(*s, ANT_CSPACE)) return s;  // Usual case: no run
+  s = ant_simd_skip(s, eof, ' ', '\t', '\r' - '\t');
+  while (s < eof && ant_is(*s, ANT_CSPACE)) s++;
+  return s;
+}
+
+// Return the end of the identifier that starts at `s`
+static inline const char *ant_skip_ident(const char *s, const char *eof) {
+  while (s < eof && ant_is(*s, ANT_CIDENT)) s++;
+  return s;
+}
+
+#if ANT_SWAR
+// Return true if all 8 bytes of `v` are decimal digits
+static inline int ant_swar_isdigits(uint64_t v) {
+  return ((v + 0x4646464646464646ULL) | (v - 0x3030303030303030ULL)) &
+                 0x8080808080808080ULL
+             ? 0
+             : 1;
+}
+
+// Return the value of the 8 decimal digits in `v`, first digit lowest
+static inline unsigned long ant_swar8(uint64_t v) {
+  v -= 0x3030303030303030ULL;  // Digit values
+  v = v * 10 + (v >> 8);       // Values of digit pairs, in every other byte
+  v = ((v & 0xff000000ffULL) * 0xf424000000064ULL +  // * 100 and * 1000000
+       (v >> 16 & 0xff000000ffULL) * 0x271000000001ULL) >> 32;  // 1, 10000
+  return (unsigned long) v;
+}
+#endif
+
+// Parse the integer literal at `s`, which starts with a digit, and store its
+// end into `*end`. Like strtoul(s, end, 0), accept decimal, "0x" hex and "0"
+// octal, and return ULONG_MAX on overflow, but without locale and errno
+static inline antval_t ant_num(const char *s, const char *eof,
+                               const char **end) {
+  unsigned long v = 0, base = 10, max, d;
+  if (s[0] == '0' && (s[1] | 0x20) == 'x' && ant_is(s[2], ANT_CHEX)) {
+    base = 16, s += 2;
+  } else if (s[0] == '0') {
+    base = 8;
+  } else {
+    // Decimal digits, as long as they cannot overflow
+#if ANT_SWAR
+    uint64_t w;
+    while (eof - s >= 8 && v <= (ULONG_MAX - 99999999) / 100000000 &&
+           (memcpy(&w, s, sizeof(w)), ant_swar_isdigits(w))) {
+      v = v * 100000000 + ant_swar8(w), s += 8;
+    }
+#endif
+    for (; s < eof && ant_is(*s, ANT_CDIGIT); s++) {
+      if (v > (ULONG_MAX - 9) / 10) break;
+      v = v * 10 + (unsigned long) (*s - '0');
+    }
+  }
+  for (max = ULONG_MAX / base; s < eof && ant_is(*s, ANT_CHEX); s++) {
+    d = (unsigned long) (*s <= '9' ? *s - '0' : (*s | 0x20) - 'a' + 10);
+    if (d >= base) break;
+    v = v > max || v * base > ULONG_MAX - d ? ULONG_MAX : v * base + d;
+  }
+  *end = s;
+  return (antval_t) v;
+}
+
+// Shared tokenizer of ant_next() and ant4_next(). Skip whitespace at `*ps`,
+// scan one token and advance `*ps` past it. A byte of class `id` starts an
+// identifier: return Var and consume that byte only, the caller reads the
+// rest. A number returns Num and its value in `*val`. Any other byte is its
+// own token, except for the two-byte Eq, Inc and Dec
+static inline int ant_lex(const char **ps, const char *eof, int id,
+                          antval_t *val) {
+  const char *s = ant_skip_space(*ps, eof);
+  int tok = s < eof ? *(uint8_t *) s : 0;
+  if (s >= eof) {
+    tok = Eof;
+  } else if (ant_is(tok, id)) {
+    tok = Var, s++;
+  } else if (ant_is(tok, ANT_CDIGIT)) {
+    *val = ant_num(s, eof, &s);
+    tok = Num;
+  } else if (s[1] == '=' && (tok == '=' || tok == '+' || tok == '-')) {
+    tok = tok == '=' ? (int) Eq : tok == '+' ? (int) Inc : (int) Dec, s += 2;
+  } else {
+    s++;
+  }
+  *ps = s;
+  return tok;
+}
+
 static inline int ant_next(struct ant *ant) {
   if (ant->tok != Inv) {
     // Do nothing. A previously parsed token has not been consumed, return it
     // printf("not consumed...\n");
-  } else if (ant->pc >= ant->eof) {
-    ant->tok = Eof;
   } else {
-    while (isspace(*(unsigned char *) ant->pc)) ant->pc++;
-    // clang-format off
-    switch (*ant->pc) {
-      case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g':
-      case 'h': case 'i': case 'j': case 'k': case 'l': case 'm': case 'n':
-      case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
-      case 'v': case 'w': case 'x': case 'y': case 'z':
-        ant->tok = Var;
-        ant->val = *ant->pc++ - 'a';
-        break;
-      case '0': case '1': case '2': case '3': case '4':
-      case '5': case '6': case '7': case '8': case '9':
-        ant->val = strtoul(ant->pc, (char **) &ant->pc, 0);
-        ant->tok = Num;
-        break;
-      case '=':
-        ant->tok = ant->pc[1] == '=' ? (int) Eq : (int) '=';
-        ant->pc += ant->tok == Eq ? 2 : 1;
-        break;
-      case '+':
-        ant->tok = ant->pc[1] == '=' ? (int) Inc : (int) '+';
-        ant->pc += ant->tok == Inc ? 2 : 1;
-        break;
-      case '-':
-        ant->tok = ant->pc[1] == '=' ? (int) Dec : (int) '-';
-        ant->pc += ant->tok == Dec ? 2 : 1;
-        break;
-      default:
-        ant->tok = *ant->pc++;
-        break;
-    }
+    ant->tok = ant_lex(&ant->pc, ant->eof, ANT_CLOWER, &ant->val);
+    if (ant->tok == Var) ant->val = ant->pc[-1] - 'a';
   }
-  // clang-format on
   // printf("TOK %d %c\n", ant->tok, ant->tok);
   return ant->tok;
 }
@@ -203,16 +427,84 @@ static inline antval_t ant_expr(struct ant *ant) {
   return ant_assignment(ant);
 }
 
+#if ANT_JUMPS > 0
+// Resolve jump destinations in one pass over the script, so that a taken
+// jump does a table lookup instead of scanning the source for a label. The
+// table is indexed by the number of '@' before the jump. Statements run in
+// source order between jumps, so the evaluator keeps that number in
+// ant->site, and every destination stores the number for its position
+static inline void ant_prescan(struct ant *ant) {
+  const char *p, *label = ant->buf;
+  int i, unresolved = 0, count = 0, at_label = 0;
+  ant->njumps = ant->site = 0;
+  for (p = ant->buf; p < ant->eof; p++) {
+    if (*p == '#') {
+      label = p + 1, at_label = count > 255 ? 255 : count;
+      for (i = unresolved; i < ant->njumps; i++) {
+        if (ant->jumps[i][0][1] != 'b') {
+          ant->jumps[i][1] = label, ant->sites[i] = (uint8_t) at_label;
+        }
+      }
+      unresolved = ant->njumps;
+    } else if (*p == '@') {
+      if (ant->njumps < ANT_JUMPS) {
+        ant->jumps[ant->njumps][0] = p;
+        ant->jumps[ant->njumps][1] = p[1] == 'b' ? label : ant->eof;
+        ant->sites[ant->njumps++] = (uint8_t) (p[1] == 'b' ? at_label : 255);
+      }
+      count++;
+    }
+  }
+}
+
+// Return destination of the jump at position `at`, which is the '@' number
+// `site`, or NULL if it is not in the table. Set ant->site for destination
+static inline const char *ant_jump_dest(struct ant *ant, const char *at,
+                                        int site) {
+  if (site >= ant->njumps || ant->jumps[site][0] != at) return NULL;
+  ant->site = ant->sites[site];
+  return ant->jumps[site][1];
+}
+
+// Recount ant->site after a jump that the table did not resolve
+static inline void ant_jump_recount(struct ant *ant) {
+  const char *p;
+  for (ant->site = 0, p = ant->buf; p < ant->pc; p++) ant->site += *p == '@';
+}
+#endif
+
 static inline void ant_jump(struct ant *ant) {
+  const char *at = ant->pc - 1;
   int inc = *ant->pc++ == 'b' ? -1 : 1;
+#if ANT_JUMPS > 0
+  int site = ant->site++;
+#endif
+  (void) at;
   if (ant_expr(ant)) {
-    const char *limit = inc > 0 ? ant->eof : ant->buf;
+    const char *limit;
+#if ANT_JUMPS > 0
+    const char *dest = ant_jump_dest(ant, at, site);
+#endif
+    ant_swallow(ant);  // Lookahead token is not at the destination
+#if ANT_JUMPS > 0
+    if (dest != NULL) {
+      ant->pc = dest;
+      return;
+    }
+#endif
+    limit = inc > 0 ? ant->eof : ant->buf;
     while (ant->pc != limit && *ant->pc != '#') ant->pc += inc;
     if (*ant->pc == '#') ant->pc++;  // Skip label
+#if ANT_JUMPS > 0
+    ant_jump_recount(ant);
+#endif
   }
 }
 
-static inline void ant_stmt_list(struct ant *ant, int etok) {
+// Run statements, return the value of the last expression statement that
+// ran, or 0. Jump conditions are not expression statements
+static inline antval_t ant_stmt_list(struct ant *ant, int etok) {
+  antval_t res = 0;
   int tok;
   while ((tok = ant_next(ant)) != etok || tok != Eof) {
     if (tok == ';') {
@@ -224,16 +516,17 @@ static inline void ant_stmt_list(struct ant *ant, int etok) {
       ant_swallow(ant);
       ant_jump(ant);
     } else {
-      ant->val = ant_expr(ant);
+      res = ant_expr(ant);
     }
   }
+  return res;
 }
 
 #if 0
 static inline int ant_copy(struct ant *ant, const char *str) {
   int i = 0, j = 0;
   while (str[i] != 0) {
-    if (isspace(*(unsigned char *) &str[i])) {
+    if (ant_is(str[i], ANT_CSPACE)) {
       i++;
     } else {
       ant->code[j++] = str[i++];
@@ -250,16 +543,18 @@ static inline antval_t ant_eval(struct ant *ant, const char *str) {
   ant->eof = &ant->pc[strlen(str)];
   ant->err[0] = '\0';
   ant->tok = Inv;
-  ant_stmt_list(ant, Eof);
-  return ant->val;
+#if ANT_JUMPS > 0
+  ant_prescan(ant);
+#endif
+  return ant->val = ant_stmt_list(ant, Eof);
 }
 
 /////////////////////////////////////////////// ANT 2
 struct ant2 {
   const char *buf, *pc, *eof;
-  antval_t vars['z' - 'a'];  // Variables
-  antval_t stack[10];        // Stack
-  int sp;                    // Stack pointer
+  antval_t vars['z' - 'a' + 1];  // Variables
+  antval_t stack[10];            // Stack
+  int sp;                        // Stack pointer
 };
 
 #define ANT2_INITIALIZER \
@@ -281,7 +576,7 @@ static inline antval_t ant2_eval(struct ant2 *ant, const char *str) {
         break;
       case '0': case '1': case '2': case '3': case '4':
       case '5': case '6': case '7': case '8': case '9':
-        ant->stack[ant->sp++] = strtoul(&ant->pc[-1], (char **) &ant->pc, 0);
+        ant->stack[ant->sp++] = ant_num(&ant->pc[-1], ant->eof, &ant->pc);
         break;
       case '=':
         ant->vars[*ant->pc++ - 'a'] = ant->stack[--ant->sp];
@@ -321,7 +616,9 @@ static inline antval_t ant2_eval(struct ant2 *ant, const char *str) {
       case ';':
         ant->sp--;
         break;
-      default: break;
+      default:
+        ant->pc = ant_skip_space(ant->pc, ant->eof);
+        break;
     }
     // clang-format on
   }
@@ -329,272 +626,3794 @@ static inline antval_t ant2_eval(struct ant2 *ant, const char *str) {
 }
 
 /////////////////////////////////////////////// ANT 3
+// Native function called by CallNative. Functions of 0 to 4 arguments are
+// called with arguments in registers, like a direct C call. A function with
+// nargs -1 has ant3_fn_t type and gets a pointer to its arguments on the
+// ant3 stack, with no copying
+typedef antval_t (*ant3_fn_t)(const antval_t *args, int nargs);
+typedef antval_t (*ant3_fn0_t)(void);
+typedef antval_t (*ant3_fn1_t)(antval_t);
+typedef antval_t (*ant3_fn2_t)(antval_t, antval_t);
+typedef antval_t (*ant3_fn3_t)(antval_t, antval_t, antval_t);
+typedef antval_t (*ant3_fn4_t)(antval_t, antval_t, antval_t, antval_t);
+
+struct ant3_fn {
+  const char *name;  // Name used by the compiler. NULL ends the table
+  void (*fn)(void);  // Function, cast to its actual type
+  int nargs;         // Number of arguments, or -1 for ant3_fn_t
+};
+#define ANT3_FN(name, fn, nargs) \
+  { (name), (void (*)(void)) (fn), (nargs) }
+
 struct ant3 {
-  antval_t imm[10];          // Immediate values
-  antval_t vars['z' - 'a'];  // Variables
-  antval_t stack[10];        // Stack
-  int sp;
+  antval_t imm[10];           // Immediate values
+  antval_t vars[ANT3_VARS];   // Variables
+  antval_t stack[10];         // Stack
+  int sp;                     // Stack pointer
+  const struct ant3_fn *fns;  // Native functions, called by CallNative
+#if ANT3_PROFILE
+  struct ant3_prof *prof;     // Profile counters, or NULL
+#endif
 };
 
+// Call native function `f` with `nargs` arguments at `args`
+static inline antval_t ant3_call(const struct ant3_fn *f, const antval_t *args,
+                                 int nargs) {
+  switch (f->nargs) {
+    case 0: return ((ant3_fn0_t) f->fn)();
+    case 1: return ((ant3_fn1_t) f->fn)(args[0]);
+    case 2: return ((ant3_fn2_t) f->fn)(args[0], args[1]);
+    case 3: return ((ant3_fn3_t) f->fn)(args[0], args[1], args[2]);
+    case 4: return ((ant3_fn4_t) f->fn)(args[0], args[1], args[2], args[3]);
+    default: return ((ant3_fn_t) f->fn)(args, nargs);
+  }
+}
+
 enum {
-  // OP       params               Description
-  Done,       //                    The end
-  IncVar,     // var_idx            Increment variable by var index
-  Assign,     // var_idx imm_idx    Assign value to a variable
-  PushVar,    // var_idx            Push variable to stack
-  PopVar,     // var_idx            Pop to variable from stack
-  PushImm,    // var_idx            Push immediate to stack
-  Plus,       //                    Add on-stack values
-  Div,        //                    Divide on-stack values
-  Pop,        //                    Pop value from stack
-  CmpVarImm,  // var_idx imm_idx    Push comparison (var - imm) result
-  Jump,       // offset             Jump if stack top is non zero
+  // OP          params              Description
+  Done,          //                   The end, return stack[0] or 0
+  IncVar,        // var               Increment variable by var index
+  Assign,        // var imm           Assign value to a variable
+  PushVar,       // var               Push variable to stack
+  PopVar,        // var               Pop to variable from stack
+  PushImm,       // imm               Push immediate to stack
+  Plus,          //                   Add on-stack values
+  Div,           //                   Divide on-stack values
+  Pop,           //                   Pop value from stack
+  CmpVarImm,     // var imm           Push comparison (var - imm) result
+  Jump,          // offset            Jump if stack top is non zero
+  Minus,         //                   Subtract on-stack values
+  Mul,           //                   Multiply on-stack values
+  Equal,         //                   Push 1 if on-stack values are equal
+  Less,          //                   Push 1 if lower value is less than top
+  More,          //                   Push 1 if lower value is more than top
+  AddVarVar,     // var var           Push sum of two variables
+  DivVarImm,     // var imm           Push variable divided by immediate
+  AccumVar,      // var               Pop and add to variable
+  JumpVarLtVar,  // var var rel16     Jump if var is less than var
+  JumpVarLtImm,  // var imm rel16     Jump if var is less than immediate
+  JumpVarNeImm,  // var imm rel16     Jump if var is not equal to immediate
+  DivMagic,      // imm flags         Divide stack top by a constant
+  JumpS,         // rel8              Jump if stack top is non zero, short
+  JumpL,         // rel16             Jump if stack top is non zero, long
+  PushI8,        // int8              Push inline 8-bit value
+  PushI16,       // int16             Push inline 16-bit value
+  PushI32,       // int32             Push inline 32-bit value
+  PushI64,       // int64             Push inline 64-bit value
+  CallNative,    // fn nargs          Pop nargs values, push fns[fn] result
+  Func,          // nargs rel16       Function body follows, jump over it
+  Call,          // rel16 nargs       Call function, return address to frame
+  Ret,           // nargs             Drop arguments under the result, return
+  Pick,          // depth             Push a copy of the n-th value, 1 is top
+  Nip,           // count             Drop n values under the stack top
 };
 
-static inline antval_t ant3_eval(struct ant3 *ant, const unsigned char *pc) {
-  const unsigned char *saved = pc;
-  ant->sp = 0;
-  while (*pc) {
-    antval_t *v;
-    switch (*pc++) {
-      case IncVar:
-        ant->vars[*pc++]++;
-        break;
-      case PushVar:
-        ant->stack[ant->sp++] = ant->vars[*pc++];
-        break;
-      case PopVar:
-        ant->vars[*pc++] = ant->stack[--ant->sp];
-        break;
-      case PushImm:
-        ant->stack[ant->sp++] = ant->imm[*pc++];
-        break;
-      case Assign:
-        ant->vars[pc[0]] = ant->imm[pc[1]];
-        pc += 2;
-        break;
-      case Plus:
-        v = &ant->stack[ant->sp-- - 2];
-        v[0] += v[1];
-        break;
-      case Div:
-        v = &ant->stack[ant->sp-- - 2];
-        v[0] /= v[1];
-        break;
-      case CmpVarImm: {
-        antval_t var = ant->vars[*pc++], imm = ant->imm[*pc++];
-        // printf("CMP %ld %ld\n", var, imm);
-        ant->stack[ant->sp++] = var - imm;
-        break;
-      }
-      case Jump: {
-        unsigned char offset = *pc++;
-        if (ant->stack[--ant->sp]) pc = saved + offset;
-        break;
-      }
-      default:
-        break;
-    }
-  }
-  return ant->stack[0];
+// Opcode description, used by the bytecode tools
+struct ant3_op {
+  const char *name;  // Opcode name
+  const char *args;  // Operands: v - var, V - modified var, i - imm,
+                     // b - byte value, t - jump target, r and R - 8 and
+                     // 16-bit jump offset relative to the instruction,
+                     // 1, 2, 4, 8 - inline signed value of that many bytes,
+                     // f - native function index, n - number of values
+  uint8_t pop;       // Number of values popped from the stack, see ant3_pops
+  uint8_t push;      // Number of values pushed to the stack
+};
+
+static inline const struct ant3_op *ant3_op(int op) {
+  static const struct ant3_op ops[] = {
+      {"Done", "", 0, 0},          {"IncVar", "V", 0, 0},
+      {"Assign", "Vi", 0, 0},      {"PushVar", "v", 0, 1},
+      {"PopVar", "V", 1, 0},       {"PushImm", "i", 0, 1},
+      {"Plus", "", 2, 1},          {"Div", "", 2, 1},
+      {"Pop", "", 1, 0},           {"CmpVarImm", "vi", 0, 1},
+      {"Jump", "t", 1, 0},         {"Minus", "", 2, 1},
+      {"Mul", "", 2, 1},           {"Equal", "", 2, 1},
+      {"Less", "", 2, 1},          {"More", "", 2, 1},
+      {"AddVarVar", "vv", 0, 1},   {"DivVarImm", "vi", 0, 1},
+      {"AccumVar", "V", 1, 0},     {"JumpVarLtVar", "vvR", 0, 0},
+      {"JumpVarLtImm", "viR", 0, 0}, {"JumpVarNeImm", "viR", 0, 0},
+      {"DivMagic", "ib", 1, 1},    {"JumpS", "r", 1, 0},
+      {"JumpL", "R", 1, 0},        {"PushI8", "1", 0, 1},
+      {"PushI16", "2", 0, 1},      {"PushI32", "4", 0, 1},
+      {"PushI64", "8", 0, 1},      {"CallNative", "fn", 0, 1},
+      {"Func", "nR", 0, 0},        {"Call", "Rn", 0, 1},
+      {"Ret", "n", 1, 1},          {"Pick", "n", 0, 1},
+      {"Nip", "n", 1, 1},
+  };
+  return op < (int) (sizeof(ops) / sizeof(ops[0])) ? &ops[op] : NULL;
 }
 
-// Using computed goto. Available on GCC and Clang
-#if defined(__GNUC__) || defined(__clang__)
-static inline antval_t ant3_eval2(struct ant3 *ant, const unsigned char *pc) {
-  void *tab[] = {&&Done, &&IncVar, &&Assign, &&PushVar,   &&PopVar, &&PushImm,
-                 &&Plus, &&Div,    &&Pop,    &&CmpVarImm, &&Jump};
-  const unsigned char *saved = pc;
-  antval_t *v;
-  ant->sp = 0;
-  goto *tab[*pc++];
-IncVar:
-  // printf("INC\n");
-  ant->vars[*pc++]++;
-  goto *tab[*pc++];
-PushVar:
-  // printf("PushV\n");
-  ant->stack[ant->sp++] = ant->vars[*pc++];
-  goto *tab[*pc++];
-PopVar:
-  // printf("PopV\n");
-  ant->vars[*pc++] = ant->stack[--ant->sp];
-  goto *tab[*pc++];
-PushImm:
-  // printf("PushImm\n");
-  ant->stack[ant->sp++] = ant->imm[*pc++];
-  goto *tab[*pc++];
-Assign:
-  // printf("Assign\n");
-  ant->vars[pc[0]] = ant->imm[pc[1]];
-  pc += 2;
-  goto *tab[*pc++];
-Plus:
-  // printf("Plus\n");
-  v = &ant->stack[ant->sp-- - 2];
-  v[0] += v[1];
-  goto *tab[*pc++];
-Div:
-  // printf("Div\n");
-  v = &ant->stack[ant->sp-- - 2];
-  v[0] /= v[1];
-  goto *tab[*pc++];
-Pop:
-  // printf("Pop\n");
-  goto *tab[*pc++];
-CmpVarImm : {
-  antval_t var = ant->vars[*pc++], imm = ant->imm[*pc++];
-  // printf("CMP %ld %ld\n", var, imm);
-  ant->stack[ant->sp++] = var - imm;
-  goto *tab[*pc++];
+// Return size of the operand of kind `arg`
+static inline size_t ant3_argsize(char arg) {
+  return arg == 'R' || arg == '2' ? 2 : arg == '4' ? 4 : arg == '8' ? 8 : 1;
 }
-Jump : {
-  unsigned char offset = *pc++;
-  // printf("Jump\n");
-  if (ant->stack[--ant->sp]) pc = saved + offset;
-  goto *tab[*pc++];
+
+// Return size of the instruction at pc, including opcode
+static inline size_t ant3_oplen(const uint8_t *pc) {
+  const struct ant3_op *op = ant3_op(*pc);
+  size_t k, n = 1;
+  for (k = 0; op != NULL && op->args[k] != '\0'; k++) {
+    n += ant3_argsize(op->args[k]);
+  }
+  return n;
 }
-Done:
-  // printf("Done\n");
-  return ant->stack[0];
+
+// Return number of values popped by the instruction at pc
+static inline int ant3_pops(const uint8_t *pc) {
+  switch (pc[0]) {
+    case CallNative: return pc[2];
+    case Call: return pc[3];
+    case Ret:
+    case Nip: return pc[1] + 1;
+    default: return ant3_op(pc[0])->pop;
+  }
 }
-#endif  // __GNUC__ or __clang__
 
-/////////////////////////////////////////////// ANT 4
-struct ant4 {
-  const char *s;  // Source code. Required by compiler
-  antval_t val;   // Parsed value. Required by compiler
-  int tok;
+// Return offset of the k-th operand of the instruction at pc
+static inline size_t ant3_argofs(const uint8_t *pc, size_t k) {
+  const char *args = ant3_op(*pc)->args;
+  size_t i, n = 1;
+  for (i = 0; i < k; i++) n += ant3_argsize(args[i]);
+  return n;
+}
 
-  uint8_t *ssym, *esym;        // Symbol table
-  uint8_t *scode, *ecode;      // Code
-  antval_t *sstk, *estk, *sp;  // Stack
-};
+// Decode 8 and 16-bit signed relative jump offsets
+static inline long ant3_rel8(const uint8_t *p) {
+  return ((long) p[0] ^ 0x80) - 0x80;
+}
 
-enum { AEOF, AINC, APLUS, AMUL, APUSH, APOP };
-enum { TINV, TEOF, TINC, TPLUS, TMUL, TNUM, TVAR };
+static inline long ant3_rel16(const uint8_t *p) {
+  return ((long) (p[0] | p[1] << 8) ^ 0x8000) - 0x8000;
+}
 
-static inline int ant4_next(struct ant4 *ant) {
-  if (ant->tok != TINV) return ant->tok;
-  if (*ant->s == 0) return TEOF;
-  while (*ant->s == ' ') ant->s++;
-  // clang-format off
-  switch(*ant->s++) {
-#if 0
-    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g':
-    case 'h': case 'i': case 'j': case 'k': case 'l': case 'm': case 'n':
-    case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
-    case 'v': case 'w': case 'x': case 'y': case 'z':
-      ant->tok = Var;
-      ant->val = *ant->pc++ - 'a';
-      break;
-#endif
-    case '0': case '1': case '2': case '3': case '4':
-    case '5': case '6': case '7': case '8': case '9':
-      ant->val = strtoul(ant->s -1, (char **) &ant->s, 0);
-      ant->tok = TNUM;
-      break;
-    case '+': ant->tok = TPLUS; break;
-    case '*': ant->tok = TMUL; break;
-    default: ant->tok = TEOF; break;
+// Decode a little-endian signed value of `size` bytes
+static inline antval_t ant3_int(const uint8_t *p, size_t size) {
+  unsigned long v = 0;
+  size_t i;
+  for (i = size; i > 0; i--) v = v << 8 | p[i - 1];
+  if (size < sizeof(v)) {
+    unsigned long sign = 1UL << (size * 8 - 1);
+    v = (v ^ sign) - sign;
   }
-  // clang-format on
-  // printf("tok : %d\n", ant->tok);
-  return ant->tok;
+  return (antval_t) v;
 }
 
-static inline void ant4_num(struct ant4 *ant) {
-  if (ant4_next(ant) == TNUM) {
-    ant->tok = TINV;
-    *ant->estk-- = ant->val;
-    *ant->ecode++ = APUSH;
-    *ant->ecode++ = ant->sstk - ant->estk - 1;
-    // printf("---> %ld %d\n", ant->estk[1], ant->ecode[-1]);
+// Write the shortest inline push of `val` into `out`. Return its size
+static inline size_t ant3_pushi(uint8_t *out, antval_t val) {
+  size_t i, size = 1;
+  while (size < sizeof(val) && (val < -(1L << (size * 8 - 1)) ||
+                                val >= (1L << (size * 8 - 1)))) {
+    size *= 2;
   }
+  out[0] = size == 1 ? PushI8 : size == 2 ? PushI16 : size == 4 ? PushI32
+                                                                : PushI64;
+  for (i = 0; i < size; i++) out[1 + i] = (uint8_t) (val >> (i * 8));
+  return 1 + size;
 }
 
-static inline void ant4_mul_div(struct ant4 *ant) {
-  ant4_num(ant);
-  if (ant4_next(ant) == TMUL) {
-    ant->tok = TINV;
-    ant4_mul_div(ant);
-    *ant->ecode++ = AMUL;
+// If the instruction at code[i] pushes a constant, store it into `*val` and
+// return 1. Otherwise, return 0
+static inline int ant3_push_const(const struct ant3 *vm, const uint8_t *code,
+                                  size_t i, antval_t *val) {
+  if (code[i] == PushImm) {
+    *val = vm->imm[code[i + 1]];
+  } else if (code[i] >= PushI8 && code[i] <= PushI64) {
+    *val = ant3_int(&code[i + 1], ant3_oplen(&code[i]) - 1);
+  } else {
+    return 0;
   }
+  return 1;
 }
 
-static inline void ant4_add_sub(struct ant4 *ant) {
-  ant4_mul_div(ant);
-  if (ant4_next(ant) == TPLUS) {
-    ant->tok = TINV;
-    ant4_add_sub(ant);
-    *ant->ecode++ = APLUS;
-  }
+// Return true if an instruction does not modify variables or control flow
+static inline int ant3_pure(int opcode) {
+  const struct ant3_op *op = ant3_op(opcode);
+  return opcode != Done && op != NULL &&
+         strspn(op->args, "vib1248") == strlen(op->args);
 }
 
-static inline void ant4_compile(struct ant4 *ant) {
-  ant->tok = TINV;
-  ant4_add_sub(ant);
-  *ant->ecode++ = 0;
+// Return true if the opcode pops a value and jumps if it is non zero
+static inline int ant3_is_jump(int op) {
+  return op == Jump || op == JumpS || op == JumpL;
 }
 
-static inline void ant4_stk(antval_t *sp, antval_t *esp, const char *msg) {
-  printf("%s", msg);
-  while (sp > esp) printf("%ld ", *sp--);
-  putchar('\n');
+// Return jump target of the instruction `insn` that sits at code offset
+// `at`, or -1 if it's not a jump
+static inline long ant3_target_at(const uint8_t *insn, size_t at) {
+  const struct ant3_op *op = ant3_op(insn[0]);
+  const char *t = op == NULL ? NULL : strpbrk(op->args, "trR");
+  const uint8_t *p;
+  if (t == NULL) return -1;
+  p = &insn[ant3_argofs(insn, (size_t) (t - op->args))];
+  if (*t == 't') return (long) p[0];
+  return (long) at + (*t == 'r' ? ant3_rel8(p) : ant3_rel16(p));
 }
 
-static inline antval_t ant4_exec(struct ant4 *ant) {
-  antval_t *sp = ant->estk, *esp = ant->sstk;
-  uint8_t *pc = ant->scode;
-  sp[0] = 0;
-  // ant4_stk(esp, sp, "BEFORE EXEC ");
-  while (*pc) {
-    switch (*pc++) {
-      case APOP:
-        sp[0] = esp[-*pc++];
-        sp++;
-        // ant4_stk(esp, sp, "POP ");
-        break;
-      case APUSH:
-        sp[0] = esp[-*pc++];
-        sp--;
-        // ant4_stk(esp, sp, "PUSH ");
-        break;
-      case APLUS:
-        sp[2] += sp[1];
-        sp++;
-        // ant4_stk(esp, sp, "PLUS ");
-        break;
-      case AMUL:
-        sp[2] *= sp[1];
-        sp++;
-        // ant4_stk(esp, sp, "MUL ");
-        break;
-      default:
-        break;
-    }
-  }
-  return ant->estk[0];
+// Return jump target of the instruction at code[i], or -1 if it's not a jump
+static inline long ant3_target(const uint8_t *code, size_t i) {
+  return ant3_target_at(&code[i], i);
 }
 
-static inline antval_t ant4_eval(struct ant4 *ant, const char *str) {
-  // printf("=========================== EVAL %s\n", str);
-  ant->s = str;
-  ant4_compile(ant);
-  return ant4_exec(ant);
+// Set jump target of the instruction `insn` that sits at code offset `at`.
+// Return 0 if it does not fit
+static inline int ant3_set_target_at(uint8_t *insn, size_t at, size_t target) {
+  const struct ant3_op *op = ant3_op(insn[0]);
+  const char *t = op == NULL ? NULL : strpbrk(op->args, "trR");
+  long d = (long) target - (long) at;
+  uint8_t *p;
+  if (t == NULL) return 0;
+  p = &insn[ant3_argofs(insn, (size_t) (t - op->args))];
+  if (*t == 't' && target > 255) return 0;
+  if (*t == 'r' && (d < -128 || d > 127)) return 0;
+  if (*t == 'R' && (d < -32768 || d > 32767)) return 0;
+  p[0] = (uint8_t) (*t == 't' ? (long) target : d);
+  if (*t == 'R') p[1] = (uint8_t) ((unsigned long) d >> 8);
+  return 1;
 }
 
-static size_t ant_roundup(size_t size, size_t align) {
-  return (size + align - 1) / align * align;
+// Set jump target of the instruction at code[i]. Return 0 if it does not fit
+static inline int ant3_set_target(uint8_t *code, size_t i, size_t target) {
+  return ant3_set_target_at(&code[i], i, target);
 }
 
-static inline struct ant4 *ant4_create(void *buf, size_t len) {
-  struct ant4 *ant = (struct ant4 *) buf;
+// High half of the signed product a * b
+static inline antval_t ant3_mulhs(antval_t a, antval_t b) {
+#if defined(__SIZEOF_INT128__)
+  // __extension__ keeps -pedantic quiet about the non-standard type
+  if (sizeof(antval_t) == 8) {
+    return (antval_t) (__extension__((__int128) a * b) >> 64);
+  }
+#endif
+  const int h = (int) sizeof(antval_t) * 4;
+  const unsigned long ua = (unsigned long) a, ub = (unsigned long) b;
+  const unsigned long mask = (1UL << h) - 1;
+  unsigned long lo = (ua & mask) * (ub & mask);
+  unsigned long m1 = (ua >> h) * (ub & mask) + (lo >> h);
+  unsigned long m2 = (ua & mask) * (ub >> h) + (m1 & mask);
+  unsigned long hi = (ua >> h) * (ub >> h) + (m1 >> h) + (m2 >> h);
+  return (antval_t) (hi - (a < 0 ? ub : 0) - (b < 0 ? ua : 0));
+}
+
+// Compute magic multiplier and flags for signed division by a constant `d`,
+// see Hacker's Delight, 10-4. Flags hold the shift in bits 0..5, and 0x40 or
+// 0x80 if the dividend must be added or subtracted. Return 0 if `d` is 0, 1,
+// -1 or the minimal value
+static inline int ant3_magic(antval_t d, antval_t *m, uint8_t *flags) {
+  const int bits = (int) sizeof(antval_t) * 8;
+  const unsigned long two = 1UL << (bits - 1);
+  unsigned long ad = d < 0 ? 0UL - (unsigned long) d : (unsigned long) d;
+  unsigned long t = two + ((unsigned long) d >> (bits - 1));
+  unsigned long anc, q1, r1, q2, r2, delta;
+  int p = bits - 1;
+  if (ad <= 1 || ad == two) return 0;
+  anc = t - 1 - t % ad;
+  q1 = two / anc, r1 = two - q1 * anc;
+  q2 = two / ad, r2 = two - q2 * ad;
+  do {
+    p++;
+    q1 *= 2, r1 *= 2;
+    if (r1 >= anc) q1++, r1 -= anc;
+    q2 *= 2, r2 *= 2;
+    if (r2 >= ad) q2++, r2 -= ad;
+    delta = ad - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+  *m = (antval_t) (d < 0 ? 0UL - (q2 + 1) : q2 + 1);
+  *flags = (uint8_t) ((p - bits) | (d > 0 && *m < 0 ? 0x40 : 0) |
+                      (d < 0 && *m > 0 ? 0x80 : 0));
+  return 1;
+}
+
+// Divide `n` by a constant, using magic multiplier and flags from ant3_magic()
+static inline antval_t ant3_divmagic(antval_t n, antval_t m, uint8_t flags) {
+  antval_t q = ant3_mulhs(n, m);
+  if (flags & 0x40) q += n;
+  if (flags & 0x80) q -= n;
+  q >>= flags & 0x3f;
+  return q + (antval_t) ((unsigned long) q >> (sizeof(antval_t) * 8 - 1));
+}
+
+// Return stack depth at offset `ofs`, following code linearly from the
+// start, or -1 if `ofs` is not an instruction offset. Function bodies are
+// skipped, inside a body the depth starts at the number of arguments
+static inline long ant3_depth(const uint8_t *code, size_t len, size_t ofs) {
+  long depth = 0;
+  size_t i = 0;
+  while (i < ofs && i < len && code[i] != Done) {
+    const struct ant3_op *op = ant3_op(code[i]);
+    long end = ant3_target(code, i);
+    if (op == NULL) return -1;
+    if (code[i] == Func && end > (long) i && end <= (long) ofs) {
+      i = (size_t) end;
+      continue;
+    }
+    depth = code[i] == Func ? code[i + 1]
+                            : depth + op->push - ant3_pops(&code[i]);
+    i += ant3_oplen(&code[i]);
+  }
+  return i == ofs && i < len ? depth : -1;
+}
+
+// Return offset of the Func instruction whose body holds code[ofs], or -1
+static inline long ant3_body(const uint8_t *code, size_t len, size_t ofs) {
+  size_t i;
+  for (i = 0; i < ofs && i < len && code[i] != Done;
+       i += ant3_oplen(&code[i])) {
+    if (ant3_op(code[i]) == NULL) return -1;
+    if (code[i] == Func && (long) ofs < ant3_target(code, i)) return (long) i;
+  }
+  return -1;
+}
+
+// Verify code of at most `len` bytes, so that evaluators can run it without
+// checks: all opcodes are known, variable and immediate indices are in
+// range, jumps land on instructions, the stack never underflows or
+// overflows, and stack depth at a jump target is the same on all paths.
+// Function bodies must not nest and must end with Ret, jumps must stay
+// within their function, and calls go to previously defined functions, so
+// there is no recursion. Stack and frames used by a call are added to the
+// caller's depth. CallNative must name a function of the `fns` table, which
+// may be NULL, with its number of arguments unless that is -1. Return
+// maximum stack depth, or -1 if the code is malformed
+static inline int ant3_verify(const uint8_t *code, size_t len,
+                              const struct ant3_fn *fns) {
+  const size_t nvars = sizeof(((struct ant3 *) 0)->vars) / sizeof(antval_t);
+  size_t nnative = 0;
+  struct {
+    size_t ofs;              // Offset of the function's first instruction
+    int nargs, max, frames;  // Arguments, stack depth and frames it needs
+  } funcs[ANT3_FUNCS], *f;
+  size_t i, k, n, t;
+  long depth = 0, max = 0, frames = 0, body = -1, end = 0;
+  long saved[3] = {0, 0, 0};  // Caller's depth, max and frames in a body
+  int nfns = 0;
+  while (fns != NULL && fns[nnative].name != NULL) nnative++;
+  for (i = 0; i < len; i += n) {
+    const struct ant3_op *op = ant3_op(code[i]);
+    if (op == NULL || i + (n = ant3_oplen(&code[i])) > len) return -1;
+    if (ant3_pops(&code[i]) > depth) return -1;
+    if (code[i] == Pick && (code[i + 1] == 0 || code[i + 1] > depth)) {
+      return -1;
+    }
+    if (code[i] == CallNative &&
+        (code[i + 1] >= nnative || (fns[code[i + 1]].nargs >= 0 &&
+                                    fns[code[i + 1]].nargs != code[i + 2]))) {
+      return -1;
+    }
+    if (code[i] == Call) {
+      for (f = funcs; f < &funcs[nfns]; f++) {
+        if ((long) f->ofs == ant3_target(code, i)) break;
+      }
+      if (f == &funcs[nfns] || f->nargs != code[i + 3]) return -1;
+      if (depth - f->nargs + f->max > max) max = depth - f->nargs + f->max;
+      if (f->frames + 1 > frames) frames = f->frames + 1;
+      if (max > 10 || frames > ANT3_FRAMES) return -1;
+    }
+    depth += op->push - ant3_pops(&code[i]);
+    if (depth > 10) return -1;
+    if (depth > max) max = depth;
+    t = (size_t) ant3_target(code, i);
+    for (k = 0; op->args[k] != '\0'; k++) {
+      uint8_t arg = code[i + ant3_argofs(&code[i], k)];
+      if ((op->args[k] == 'v' || op->args[k] == 'V') && arg >= nvars) return -1;
+      if (op->args[k] == 'i' && arg >= 10) return -1;
+      if (op->args[k] == 'b' && (arg & 0x3f) >= sizeof(antval_t) * 8) {
+        return -1;
+      }
+      if (strchr("trR", op->args[k]) != NULL && code[i] != Call &&
+          (ant3_depth(code, len, t) != depth ||
+           ant3_body(code, len, t) != body)) {
+        return -1;
+      }
+    }
+    if (code[i] == Func) {
+      if (body >= 0 || ant3_target(code, i) <= (long) (i + n)) return -1;
+      saved[0] = depth, saved[1] = max, saved[2] = frames;
+      body = (long) i, end = ant3_target(code, i);
+      depth = max = code[i + 1], frames = 0;
+    } else if (code[i] == Ret) {
+      if (body < 0 || (long) (i + n) != end || depth != 1 ||
+          code[i + 1] != code[body + 1] || nfns >= ANT3_FUNCS) {
+        return -1;
+      }
+      funcs[nfns].ofs = (size_t) body + ant3_oplen(&code[body]);
+      funcs[nfns].nargs = code[i + 1];
+      funcs[nfns].max = (int) max, funcs[nfns++].frames = (int) frames;
+      depth = saved[0], max = saved[1], frames = saved[2], body = -1;
+    }
+    if (code[i] == Done) return body < 0 ? (int) max : -1;
+  }
+  return -1;
+}
+
+// Remove the byte at code[ofs], which is inside the instruction at code[i],
+// and fix the targets of all other jumps. `size` is code size
+static inline void ant3_cut(uint8_t *code, size_t size, size_t i, size_t ofs) {
+  size_t k;
+  for (k = 0; code[k] != Done; k += ant3_oplen(&code[k])) {
+    long t = ant3_target(code, k);
+    size_t moved = k > ofs ? k - 1 : k;  // Offset of code[k] after the cut
+    if (t < 0 || k == i) continue;
+    if (t > (long) ofs) t--;
+    if (strpbrk(ant3_op(code[k])->args, "rR") != NULL) t += (long) (k - moved);
+    ant3_set_target(code, k, (size_t) t);
+  }
+  memmove(&code[ofs], &code[ofs + 1], size - ofs - 1);
+}
+
+// Branch relaxation, in place: turn JumpL into JumpS where the target is in
+// reach. Every shrunk jump brings other targets closer, so repeat until
+// nothing changes. Return new code size
+static inline size_t ant3_relax(uint8_t *code) {
+  size_t i = 0, size, changed = 1;
+  while (code[i] != Done) i += ant3_oplen(&code[i]);
+  size = i + 1;
+  while (changed) {
+    changed = 0;
+    for (i = 0; code[i] != Done; i += ant3_oplen(&code[i])) {
+      long t = ant3_target(code, i), d = t - (long) i;
+      if (code[i] != JumpL || d < -128 || d > 128) continue;
+      ant3_cut(code, size--, i, i + 2);
+      code[i] = JumpS;
+      ant3_set_target(code, i, (size_t) (d > 0 ? t - 1 : t));
+      changed = 1;
+    }
+  }
+  return size;
+}
+
+// Opcode profile, filled by ant3_eval() and ant3_eval2() when built with
+// ANT3_PROFILE. Opcode triples are kept in a small hash table, triples that
+// find no free slot are counted as lost
+#define ANT3_OPS 64        // Opcodes counted, must exceed the last opcode
+#define ANT3_TRIPLES 1024  // Slots for opcode triples
+
+struct ant3_prof {
+  unsigned long ops[ANT3_OPS];              // Executions of every opcode
+  unsigned long pairs[ANT3_OPS][ANT3_OPS];  // Of every opcode pair
+  unsigned long triples[ANT3_TRIPLES];      // Of the triple in keys[]
+  uint32_t keys[ANT3_TRIPLES];              // Triple, 0 for a free slot
+  unsigned long lost;                       // Triples that did not fit
+  unsigned long *hits;  // Executions of the instruction at every offset
+  size_t len;           // Number of entries in hits[]
+  int last[2];          // Previous two opcodes of this run, or -1
+};
+
+// Clear profile `p`. `hits` gets per-offset counts for code of `len` bytes,
+// it can be NULL
+static inline void ant3_prof_init(struct ant3_prof *p, unsigned long *hits,
+                                  size_t len) {
+  memset(p, 0, sizeof(*p));
+  if (hits != NULL) memset(hits, 0, len * sizeof(hits[0]));
+  p->hits = hits, p->len = hits == NULL ? 0 : len;
+  p->last[0] = p->last[1] = -1;
+}
+
+// Count the instruction at `pc`, `code` is the start of the bytecode
+static inline void ant3_prof_hit(struct ant3_prof *p, const uint8_t *code,
+                                 const uint8_t *pc) {
+  size_t ofs = (size_t) (pc - code), i, n;
+  int op = *pc;
+  if (op >= ANT3_OPS) return;
+  p->ops[op]++;
+  if (p->last[1] >= 0) p->pairs[p->last[1]][op]++;
+  if (p->last[0] >= 0) {
+    uint32_t key = (uint32_t) (1 << 24 | p->last[0] << 16 | p->last[1] << 8 |
+                               op);
+    i = (size_t) ((key * 2654435761U) >> 16) % ANT3_TRIPLES;
+    for (n = 0; n < 16; n++, i = (i + 1) % ANT3_TRIPLES) {
+      if (p->keys[i] == 0) p->keys[i] = key;
+      if (p->keys[i] == key) break;
+    }
+    if (n < 16) {
+      p->triples[i]++;
+    } else {
+      p->lost++;
+    }
+  }
+  p->last[0] = p->last[1], p->last[1] = op;
+  if (ofs < p->len) p->hits[ofs]++;
+}
+
+// Among `n` counts in `v`, return the index of the next one in the order of
+// decreasing count, then increasing index, after count `*cnt` at index
+// `prev`. Update `*cnt`. Return -1 if there are no more non-zero counts.
+// Start with *cnt = ULONG_MAX and prev = -1
+static inline long ant3_prof_next(const unsigned long *v, size_t n,
+                                  unsigned long *cnt, long prev) {
+  long i, best = -1;
+  for (i = 0; i < (long) n; i++) {
+    if (v[i] == 0 || v[i] > *cnt || (v[i] == *cnt && i <= prev)) continue;
+    if (best < 0 || v[i] > v[best]) best = i;
+  }
+  if (best >= 0) *cnt = v[best];
+  return best;
+}
+
+static inline const char *ant3_prof_name(long op) {
+  const struct ant3_op *o = ant3_op((int) op);
+  return o == NULL ? "?" : o->name;
+}
+
+// Print the `top` most executed opcodes, opcode pairs and triples and, if
+// `p` has per-offset counts, code ranges of `code`. A range is a run of
+// instructions executed the same number of times, like a basic block.
+// Ranges are ordered by the number of instructions they executed
+static inline void ant3_prof_dump(const struct ant3_prof *p,
+                                  const uint8_t *code, int top, FILE *fp) {
+  unsigned long cnt = ULONG_MAX, total = 0;
+  long i = -1, k;
+  for (k = 0; k < ANT3_OPS; k++) total += p->ops[k];
+  fprintf(fp, "instructions: %lu\nopcodes:\n", total);
+  for (k = 0; k < top && (i = ant3_prof_next(p->ops, ANT3_OPS, &cnt, i)) >= 0;
+       k++) {
+    fprintf(fp, "  %12lu  %s\n", cnt, ant3_prof_name(i));
+  }
+  fprintf(fp, "pairs:\n");
+  cnt = ULONG_MAX, i = -1;
+  for (k = 0; k < top && (i = ant3_prof_next(p->pairs[0], ANT3_OPS * ANT3_OPS,
+                                             &cnt, i)) >= 0;
+       k++) {
+    fprintf(fp, "  %12lu  %s %s\n", cnt, ant3_prof_name(i / ANT3_OPS),
+            ant3_prof_name(i % ANT3_OPS));
+  }
+  fprintf(fp, "triples:\n");
+  cnt = ULONG_MAX, i = -1;
+  for (k = 0; k < top &&
+              (i = ant3_prof_next(p->triples, ANT3_TRIPLES, &cnt, i)) >= 0;
+       k++) {
+    uint32_t key = p->keys[i];
+    fprintf(fp, "  %12lu  %s %s %s\n", cnt, ant3_prof_name(key >> 16 & 255),
+            ant3_prof_name(key >> 8 & 255), ant3_prof_name(key & 255));
+  }
+  if (p->lost > 0) fprintf(fp, "  %12lu  (not tracked)\n", p->lost);
+  if (p->hits == NULL) return;
+  fprintf(fp, "ranges:\n");
+  cnt = ULONG_MAX, i = -1;
+  for (k = 0; k < top; k++) {
+    unsigned long best = 0, bn = 0, w;
+    size_t a, b, end = 0, n;
+    long start = -1;
+    for (a = 0; a < p->len; a = b) {
+      for (b = a, n = 0; b < p->len && p->hits[b] == p->hits[a]; n++) {
+        b += ant3_oplen(&code[b]);
+      }
+      w = p->hits[a] * (unsigned long) n;
+      if (w == 0 || w > cnt || (w == cnt && (long) a <= i)) continue;
+      if (start < 0 || w > best) start = (long) a, end = b, best = w, bn = n;
+    }
+    if (start < 0) break;
+    cnt = best, i = start;
+    fprintf(fp, "  %12lu  %ld-%lu, %lu instructions x %lu\n", best, start,
+            (unsigned long) end - 1, bn, best / bn);
+  }
+}
+
+// Map from code offsets to source offsets, filled by ant_compile_map() and
+// ant2_compile_map(). Every statement adds an entry: a pair of bytes with
+// the number of instructions since the previous statement and the distance
+// from its source offset. Larger distances take several pairs. Counting
+// instructions rather than bytes keeps the map valid when ant3_relax()
+// shrinks jumps. Code rewritten by ant3_fuse() or ant3_optimize() needs a
+// new map
+struct ant3_map {
+  uint8_t *buf;  // Entries
+  size_t size;   // Buffer size
+  size_t len;    // Bytes used, more than size if the buffer is too small
+  size_t pc;     // Code offset of the last entry, used while compiling
+  size_t src;    // Source offset of the last entry
+};
+
+static inline void ant3_map_put(struct ant3_map *m, size_t n, size_t d) {
+  if (m->len + 2 <= m->size) {
+    m->buf[m->len] = (uint8_t) n, m->buf[m->len + 1] = (uint8_t) d;
+  }
+  m->len += 2;
+}
+
+// Add an entry: the statement at code offset `pc` starts at source offset
+// `src`. Entries must come in code order, sources must not go back
+static inline void ant3_map_add(struct ant3_map *m, const uint8_t *code,
+                                size_t pc, size_t src) {
+  size_t n = 0, d;
+  if (src < m->src || pc < m->pc) return;
+  d = src - m->src;
+  for (; m->pc < pc; m->pc += ant3_oplen(&code[m->pc])) n++;
+  m->src = src;
+  if (n == 0 && d == 0 && m->len > 0) return;
+  for (; n > 255; n -= 255) ant3_map_put(m, 255, 0);
+  for (; d > 255; d -= 255, n = 0) ant3_map_put(m, n, 255);
+  ant3_map_put(m, n, d);
+}
+
+// Return the source offset of the statement that the instruction at code
+// offset `pc` belongs to
+static inline size_t ant3_map_find(const struct ant3_map *m,
+                                   const uint8_t *code, size_t pc) {
+  size_t i, k = 0, n = 0, src = 0;
+  for (i = 0; i < pc; i += ant3_oplen(&code[i])) k++;
+  for (i = 0; i + 2 <= m->len && i + 2 <= m->size; i += 2) {
+    if (n + m->buf[i] > k) break;
+    n += m->buf[i], src += m->buf[i + 1];
+  }
+  return src;
+}
+
+// Sum per-offset counts `hits` of `code`, `len` bytes, into per-line counts
+// of its source `src`: lines[0] gets line 1. Lines past `nlines` are added
+// to the last one. The counts can come from ant3_prof or ant3_sample_start()
+static inline void ant3_map_lines(const struct ant3_map *m, const char *src,
+                                  const uint8_t *code,
+                                  const unsigned long *hits, size_t len,
+                                  unsigned long *lines, size_t nlines) {
+  size_t pc, i = 0, k = 0, n = 0, ofs = 0, scanned = 0, line = 0;
+  memset(lines, 0, nlines * sizeof(lines[0]));
+  for (pc = 0; pc < len && nlines > 0; pc += ant3_oplen(&code[pc]), k++) {
+    for (; i + 2 <= m->len && i + 2 <= m->size && n + m->buf[i] <= k; i += 2) {
+      n += m->buf[i], ofs += m->buf[i + 1];
+    }
+    for (; scanned < ofs && src[scanned] != '\0'; scanned++) {
+      if (src[scanned] == '\n') line++;
+    }
+    lines[line < nlines ? line : nlines - 1] += hits[pc];
+  }
+}
+
+// Print the `top` lines with the largest counts, as given by
+// ant3_map_lines(), with their share of the total and their text
+static inline void ant3_lines_dump(const char *src, const unsigned long *lines,
+                                   size_t nlines, int top, FILE *fp) {
+  unsigned long cnt = ULONG_MAX, total = 0;
+  long i = -1, k;
+  for (k = 0; k < (long) nlines; k++) total += lines[k];
+  fprintf(fp, "%12s %6s %5s  source\n", "count", "%", "line");
+  for (k = 0; k < top && (i = ant3_prof_next(lines, nlines, &cnt, i)) >= 0;
+       k++) {
+    const char *p = src, *e;
+    long line;
+    for (line = 0; line < i && (p = strchr(p, '\n')) != NULL; line++) p++;
+    if (p == NULL) p = "";
+    e = strchr(p, '\n');
+    fprintf(fp, "%12lu %6.2f %5ld  %.*s\n", cnt, 100.0 * (double) cnt / total,
+            i + 1, e == NULL ? (int) strlen(p) : (int) (e - p), p);
+  }
+}
+
+#if ANT3_SAMPLE
+// Sampling profiler state. While ant3_eval() runs the sampled code, it keeps
+// code and pc up to date, and the SIGPROF handler counts pc into hits[]
+struct ant3_sampler {
+  const uint8_t *volatile code;  // Sampled code while it runs, or NULL
+  const uint8_t *volatile pc;    // Its current instruction
+  const uint8_t *prog;           // Sampled code, NULL when not sampling
+  unsigned long *hits;           // Samples per code offset of prog
+  size_t len;                    // Number of entries in hits[]
+  volatile unsigned long other;  // Samples taken outside of prog
+  struct sigaction action;       // SIGPROF action before the sampler
+  struct itimerval timer;        // ITIMER_PROF setting before the sampler
+};
+static struct ant3_sampler ant3_sampling;
+
+static inline void ant3_sample_tick(int sig) {
+  struct ant3_sampler *s = &ant3_sampling;
+  const uint8_t *code = s->code, *pc = s->pc;
+  if (code != NULL && pc >= code &&
+      (size_t) (pc - code) < s->len) {
+    s->hits[pc - code]++;
+  } else {
+    s->other++;
+  }
+  (void) sig;
+}
+
+// Count, every `usec` microseconds of process CPU time, the instruction of
+// `code` that ant3_eval() runs into `hits`, which has an entry per code
+// byte and is cleared here. ant3_sample_stop() restores the SIGPROF action
+// and the profiling timer that were set before. Return 0 on error
+static inline int ant3_sample_start(const uint8_t *code, unsigned long *hits,
+                                    size_t len, long usec) {
+  struct sigaction sa;
+  struct itimerval it;
+  memset(hits, 0, len * sizeof(hits[0]));
+  ant3_sampling.prog = code, ant3_sampling.hits = hits;
+  ant3_sampling.len = len, ant3_sampling.other = 0;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = ant3_sample_tick;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  it.it_interval.tv_sec = usec / 1000000;
+  it.it_interval.tv_usec = usec % 1000000;
+  it.it_value = it.it_interval;
+  if (sigaction(SIGPROF, &sa, &ant3_sampling.action) != 0) return 0;
+  if (setitimer(ITIMER_PROF, &it, &ant3_sampling.timer) != 0) {
+    sigaction(SIGPROF, &ant3_sampling.action, NULL);
+    return 0;
+  }
+  return 1;
+}
+
+static inline void ant3_sample_stop(void) {
+  setitimer(ITIMER_PROF, &ant3_sampling.timer, NULL);
+  sigaction(SIGPROF, &ant3_sampling.action, NULL);
+  ant3_sampling.prog = NULL;
+}
+#endif
+
+static inline antval_t ant3_eval(struct ant3 *ant, const unsigned char *pc) {
+  const unsigned char *saved = pc, *rets[ANT3_FRAMES];
+  int fp = 0;
+#if ANT3_SAMPLE
+  const int sampled = ant3_sampling.prog == saved;  // Publish pc if set
+#endif
+  ant->sp = 0;
+#if ANT3_PROFILE
+  if (ant->prof != NULL) ant->prof->last[0] = ant->prof->last[1] = -1;
+#endif
+#if ANT3_SAMPLE
+  if (sampled) ant3_sampling.pc = pc, ant3_sampling.code = saved;
+#endif
+  while (*pc) {
+    antval_t *v;
+#if ANT3_PROFILE
+    if (ant->prof != NULL) ant3_prof_hit(ant->prof, saved, pc);
+#endif
+#if ANT3_SAMPLE
+    if (sampled) ant3_sampling.pc = pc;
+#endif
+    switch (*pc++) {
+      case IncVar:
+        ant->vars[*pc++]++;
+        break;
+      case PushVar:
+        ant->stack[ant->sp++] = ant->vars[*pc++];
+        break;
+      case PopVar:
+        ant->vars[*pc++] = ant->stack[--ant->sp];
+        break;
+      case PushImm:
+        ant->stack[ant->sp++] = ant->imm[*pc++];
+        break;
+      case Assign:
+        ant->vars[pc[0]] = ant->imm[pc[1]];
+        pc += 2;
+        break;
+      case Plus:
+        v = &ant->stack[ant->sp-- - 2];
+        v[0] += v[1];
+        break;
+      case Div:
+        v = &ant->stack[ant->sp-- - 2];
+        v[0] /= v[1];
+        break;
+      case Minus:
+        v = &ant->stack[ant->sp-- - 2];
+        v[0] -= v[1];
+        break;
+      case Mul:
+        v = &ant->stack[ant->sp-- - 2];
+        v[0] *= v[1];
+        break;
+      case Equal:
+        v = &ant->stack[ant->sp-- - 2];
+        v[0] = v[0] == v[1] ? 1 : 0;
+        break;
+      case Less:
+        v = &ant->stack[ant->sp-- - 2];
+        v[0] = v[0] < v[1] ? 1 : 0;
+        break;
+      case More:
+        v = &ant->stack[ant->sp-- - 2];
+        v[0] = v[0] > v[1] ? 1 : 0;
+        break;
+      case Pop:
+        ant->sp--;
+        break;
+      case AddVarVar:
+        ant->stack[ant->sp++] = ant->vars[pc[0]] + ant->vars[pc[1]];
+        pc += 2;
+        break;
+      case DivVarImm:
+        ant->stack[ant->sp++] = ant->vars[pc[0]] / ant->imm[pc[1]];
+        pc += 2;
+        break;
+      case DivMagic:
+        v = &ant->stack[ant->sp - 1];
+        v[0] = ant3_divmagic(v[0], ant->imm[pc[0]], pc[1]);
+        pc += 2;
+        break;
+      case AccumVar:
+        ant->vars[*pc++] += ant->stack[--ant->sp];
+        break;
+      case JumpVarLtVar:
+        v = ant->vars;
+        pc = v[pc[0]] < v[pc[1]] ? pc - 1 + ant3_rel16(&pc[2]) : pc + 4;
+        break;
+      case JumpVarLtImm:
+        v = ant->vars;
+        pc = v[pc[0]] < ant->imm[pc[1]] ? pc - 1 + ant3_rel16(&pc[2]) : pc + 4;
+        break;
+      case JumpVarNeImm:
+        v = ant->vars;
+        pc = v[pc[0]] != ant->imm[pc[1]] ? pc - 1 + ant3_rel16(&pc[2]) : pc + 4;
+        break;
+      case CmpVarImm: {
+        antval_t var = ant->vars[*pc++], imm = ant->imm[*pc++];
+        // printf("CMP %ld %ld\n", var, imm);
+        ant->stack[ant->sp++] = var - imm;
+        break;
+      }
+      case Jump: {
+        unsigned char offset = *pc++;
+        if (ant->stack[--ant->sp]) pc = saved + offset;
+        break;
+      }
+      case JumpS:
+        pc = ant->stack[--ant->sp] ? pc - 1 + ant3_rel8(pc) : pc + 1;
+        break;
+      case JumpL:
+        pc = ant->stack[--ant->sp] ? pc - 1 + ant3_rel16(pc) : pc + 2;
+        break;
+      case PushI8:
+        ant->stack[ant->sp++] = ant3_int(pc, 1);
+        pc += 1;
+        break;
+      case PushI16:
+        ant->stack[ant->sp++] = ant3_int(pc, 2);
+        pc += 2;
+        break;
+      case PushI32:
+        ant->stack[ant->sp++] = ant3_int(pc, 4);
+        pc += 4;
+        break;
+      case PushI64:
+        ant->stack[ant->sp++] = ant3_int(pc, 8);
+        pc += 8;
+        break;
+      case CallNative:
+        ant->sp -= pc[1];
+        ant->stack[ant->sp] =
+            ant3_call(&ant->fns[pc[0]], &ant->stack[ant->sp], pc[1]);
+        ant->sp++;
+        pc += 2;
+        break;
+      case Func:
+        pc = pc - 1 + ant3_rel16(&pc[1]);
+        break;
+      case Call:
+        rets[fp++] = pc + 3;
+        pc = pc - 1 + ant3_rel16(pc);
+        break;
+      case Ret:
+      case Nip:
+        ant->stack[ant->sp - 1 - *pc] = ant->stack[ant->sp - 1];
+        ant->sp -= *pc++;
+        if (pc[-2] == Ret) pc = rets[--fp];
+        break;
+      case Pick:
+        ant->stack[ant->sp] = ant->stack[ant->sp - *pc++];
+        ant->sp++;
+        break;
+      default:
+        break;
+    }
+  }
+#if ANT3_PROFILE
+  if (ant->prof != NULL) ant3_prof_hit(ant->prof, saved, pc);
+#endif
+#if ANT3_SAMPLE
+  if (sampled) ant3_sampling.code = NULL;
+#endif
+  return ant->sp > 0 ? ant->stack[0] : 0;
+}
+
+// Using computed goto. Available on GCC and Clang
+#if defined(__GNUC__) || defined(__clang__)
+static inline antval_t ant3_eval2(struct ant3 *ant, const unsigned char *pc) {
+  void *tab[] = {&&Done,         &&IncVar,       &&Assign,       &&PushVar,
+                 &&PopVar,       &&PushImm,      &&Plus,         &&Div,
+                 &&Pop,          &&CmpVarImm,    &&Jump,         &&Minus,
+                 &&Mul,          &&Equal,        &&Less,         &&More,
+                 &&AddVarVar,    &&DivVarImm,    &&AccumVar,     &&JumpVarLtVar,
+                 &&JumpVarLtImm, &&JumpVarNeImm, &&DivMagic,     &&JumpS,
+                 &&JumpL,        &&PushI8,       &&PushI16,      &&PushI32,
+                 &&PushI64,      &&CallNative,   &&Func,         &&Call,
+                 &&Ret,          &&Pick,         &&Nip};
+  const unsigned char *saved = pc, *rets[ANT3_FRAMES];
+  antval_t *v;
+  int fp = 0;
+#if ANT3_PROFILE
+  // When profiling, every table entry points to Profile, which counts the
+  // instruction and jumps to its handler in run[]
+  void *run[sizeof(tab) / sizeof(tab[0])];
+  size_t k;
+  if (ant->prof != NULL) {
+    ant->prof->last[0] = ant->prof->last[1] = -1;
+    memcpy(run, tab, sizeof(tab));
+    for (k = 0; k < sizeof(tab) / sizeof(tab[0]); k++) tab[k] = &&Profile;
+  }
+#endif
+  ant->sp = 0;
+  goto *tab[*pc++];
+IncVar:
+  // printf("INC\n");
+  ant->vars[*pc++]++;
+  goto *tab[*pc++];
+PushVar:
+  // printf("PushV\n");
+  ant->stack[ant->sp++] = ant->vars[*pc++];
+  goto *tab[*pc++];
+PopVar:
+  // printf("PopV\n");
+  ant->vars[*pc++] = ant->stack[--ant->sp];
+  goto *tab[*pc++];
+PushImm:
+  // printf("PushImm\n");
+  ant->stack[ant->sp++] = ant->imm[*pc++];
+  goto *tab[*pc++];
+Assign:
+  // printf("Assign\n");
+  ant->vars[pc[0]] = ant->imm[pc[1]];
+  pc += 2;
+  goto *tab[*pc++];
+Plus:
+  // printf("Plus\n");
+  v = &ant->stack[ant->sp-- - 2];
+  v[0] += v[1];
+  goto *tab[*pc++];
+Div:
+  // printf("Div\n");
+  v = &ant->stack[ant->sp-- - 2];
+  v[0] /= v[1];
+  goto *tab[*pc++];
+Minus:
+  v = &ant->stack[ant->sp-- - 2];
+  v[0] -= v[1];
+  goto *tab[*pc++];
+Mul:
+  v = &ant->stack[ant->sp-- - 2];
+  v[0] *= v[1];
+  goto *tab[*pc++];
+Equal:
+  v = &ant->stack[ant->sp-- - 2];
+  v[0] = v[0] == v[1] ? 1 : 0;
+  goto *tab[*pc++];
+Less:
+  v = &ant->stack[ant->sp-- - 2];
+  v[0] = v[0] < v[1] ? 1 : 0;
+  goto *tab[*pc++];
+More:
+  v = &ant->stack[ant->sp-- - 2];
+  v[0] = v[0] > v[1] ? 1 : 0;
+  goto *tab[*pc++];
+Pop:
+  // printf("Pop\n");
+  ant->sp--;
+  goto *tab[*pc++];
+AddVarVar:
+  ant->stack[ant->sp++] = ant->vars[pc[0]] + ant->vars[pc[1]];
+  pc += 2;
+  goto *tab[*pc++];
+DivVarImm:
+  ant->stack[ant->sp++] = ant->vars[pc[0]] / ant->imm[pc[1]];
+  pc += 2;
+  goto *tab[*pc++];
+DivMagic:
+  v = &ant->stack[ant->sp - 1];
+  v[0] = ant3_divmagic(v[0], ant->imm[pc[0]], pc[1]);
+  pc += 2;
+  goto *tab[*pc++];
+AccumVar:
+  ant->vars[*pc++] += ant->stack[--ant->sp];
+  goto *tab[*pc++];
+JumpVarLtVar:
+  v = ant->vars;
+  pc = v[pc[0]] < v[pc[1]] ? pc - 1 + ant3_rel16(&pc[2]) : pc + 4;
+  goto *tab[*pc++];
+JumpVarLtImm:
+  v = ant->vars;
+  pc = v[pc[0]] < ant->imm[pc[1]] ? pc - 1 + ant3_rel16(&pc[2]) : pc + 4;
+  goto *tab[*pc++];
+JumpVarNeImm:
+  v = ant->vars;
+  pc = v[pc[0]] != ant->imm[pc[1]] ? pc - 1 + ant3_rel16(&pc[2]) : pc + 4;
+  goto *tab[*pc++];
+CmpVarImm : {
+  antval_t var = ant->vars[*pc++], imm = ant->imm[*pc++];
+  // printf("CMP %ld %ld\n", var, imm);
+  ant->stack[ant->sp++] = var - imm;
+  goto *tab[*pc++];
+}
+Jump : {
+  unsigned char offset = *pc++;
+  // printf("Jump\n");
+  if (ant->stack[--ant->sp]) pc = saved + offset;
+  goto *tab[*pc++];
+}
+JumpS:
+  pc = ant->stack[--ant->sp] ? pc - 1 + ant3_rel8(pc) : pc + 1;
+  goto *tab[*pc++];
+JumpL:
+  pc = ant->stack[--ant->sp] ? pc - 1 + ant3_rel16(pc) : pc + 2;
+  goto *tab[*pc++];
+PushI8:
+  ant->stack[ant->sp++] = ant3_int(pc, 1);
+  pc += 1;
+  goto *tab[*pc++];
+PushI16:
+  ant->stack[ant->sp++] = ant3_int(pc, 2);
+  pc += 2;
+  goto *tab[*pc++];
+PushI32:
+  ant->stack[ant->sp++] = ant3_int(pc, 4);
+  pc += 4;
+  goto *tab[*pc++];
+PushI64:
+  ant->stack[ant->sp++] = ant3_int(pc, 8);
+  pc += 8;
+  goto *tab[*pc++];
+CallNative:
+  ant->sp -= pc[1];
+  ant->stack[ant->sp] =
+      ant3_call(&ant->fns[pc[0]], &ant->stack[ant->sp], pc[1]);
+  ant->sp++;
+  pc += 2;
+  goto *tab[*pc++];
+Func:
+  pc = pc - 1 + ant3_rel16(&pc[1]);
+  goto *tab[*pc++];
+Call:
+  rets[fp++] = pc + 3;
+  pc = pc - 1 + ant3_rel16(pc);
+  goto *tab[*pc++];
+Ret:
+  ant->stack[ant->sp - 1 - *pc] = ant->stack[ant->sp - 1];
+  ant->sp -= *pc;
+  pc = rets[--fp];
+  goto *tab[*pc++];
+Nip:
+  ant->stack[ant->sp - 1 - *pc] = ant->stack[ant->sp - 1];
+  ant->sp -= *pc++;
+  goto *tab[*pc++];
+Pick:
+  ant->stack[ant->sp] = ant->stack[ant->sp - *pc++];
+  ant->sp++;
+  goto *tab[*pc++];
+#if ANT3_PROFILE
+Profile:
+  ant3_prof_hit(ant->prof, saved, pc - 1);
+  goto *run[pc[-1]];
+#endif
+Done:
+  // printf("Done\n");
+  return ant->sp > 0 ? ant->stack[0] : 0;
+}
+
+// Top-of-stack caching. The top stack value, the stack pointer and the
+// table pointers live in local variables, so the compiler keeps them in
+// registers. Stack memory is touched only for values below the top one.
+// Only the stack slots below the final sp are copied back to `ant`
+static inline antval_t ant3_eval_tos(struct ant3 *ant,
+                                     const unsigned char *pc) {
+  void *tab[] = {&&Done,         &&IncVar,       &&Assign,       &&PushVar,
+                 &&PopVar,       &&PushImm,      &&Plus,         &&Div,
+                 &&Pop,          &&CmpVarImm,    &&Jump,         &&Minus,
+                 &&Mul,          &&Equal,        &&Less,         &&More,
+                 &&AddVarVar,    &&DivVarImm,    &&AccumVar,     &&JumpVarLtVar,
+                 &&JumpVarLtImm, &&JumpVarNeImm, &&DivMagic,     &&JumpS,
+                 &&JumpL,        &&PushI8,       &&PushI16,      &&PushI32,
+                 &&PushI64,      &&CallNative,   &&Func,         &&Call,
+                 &&Ret,          &&Pick,         &&Nip};
+  const unsigned char *saved = pc, *rets[ANT3_FRAMES];
+  antval_t stk[11], *sp = stk, tos = 0;  // stk[0] is a slot below the bottom
+  int fp = 0;
+  antval_t *vars = ant->vars, *imm = ant->imm;
+  memcpy(&stk[1], ant->stack, sizeof(ant->stack));
+  goto *tab[*pc++];
+IncVar:
+  vars[*pc++]++;
+  goto *tab[*pc++];
+Assign:
+  vars[pc[0]] = imm[pc[1]];
+  pc += 2;
+  goto *tab[*pc++];
+PushVar:
+  *sp++ = tos;
+  tos = vars[*pc++];
+  goto *tab[*pc++];
+PopVar:
+  vars[*pc++] = tos;
+  tos = *--sp;
+  goto *tab[*pc++];
+PushImm:
+  *sp++ = tos;
+  tos = imm[*pc++];
+  goto *tab[*pc++];
+Plus:
+  tos = *--sp + tos;
+  goto *tab[*pc++];
+Div:
+  tos = *--sp / tos;
+  goto *tab[*pc++];
+Minus:
+  tos = *--sp - tos;
+  goto *tab[*pc++];
+Mul:
+  tos = *--sp * tos;
+  goto *tab[*pc++];
+Equal:
+  tos = *--sp == tos ? 1 : 0;
+  goto *tab[*pc++];
+Less:
+  tos = *--sp < tos ? 1 : 0;
+  goto *tab[*pc++];
+More:
+  tos = *--sp > tos ? 1 : 0;
+  goto *tab[*pc++];
+Pop:
+  tos = *--sp;
+  goto *tab[*pc++];
+CmpVarImm:
+  *sp++ = tos;
+  tos = vars[pc[0]] - imm[pc[1]];
+  pc += 2;
+  goto *tab[*pc++];
+Jump:
+  if (tos) {
+    tos = *--sp;
+    pc = saved + *pc;
+  } else {
+    tos = *--sp;
+    pc++;
+  }
+  goto *tab[*pc++];
+AddVarVar:
+  *sp++ = tos;
+  tos = vars[pc[0]] + vars[pc[1]];
+  pc += 2;
+  goto *tab[*pc++];
+DivVarImm:
+  *sp++ = tos;
+  tos = vars[pc[0]] / imm[pc[1]];
+  pc += 2;
+  goto *tab[*pc++];
+DivMagic:
+  tos = ant3_divmagic(tos, imm[pc[0]], pc[1]);
+  pc += 2;
+  goto *tab[*pc++];
+AccumVar:
+  vars[*pc++] += tos;
+  tos = *--sp;
+  goto *tab[*pc++];
+JumpVarLtVar:
+  pc = vars[pc[0]] < vars[pc[1]] ? pc - 1 + ant3_rel16(&pc[2]) : pc + 4;
+  goto *tab[*pc++];
+JumpVarLtImm:
+  pc = vars[pc[0]] < imm[pc[1]] ? pc - 1 + ant3_rel16(&pc[2]) : pc + 4;
+  goto *tab[*pc++];
+JumpVarNeImm:
+  pc = vars[pc[0]] != imm[pc[1]] ? pc - 1 + ant3_rel16(&pc[2]) : pc + 4;
+  goto *tab[*pc++];
+JumpS:
+  pc = tos ? pc - 1 + ant3_rel8(pc) : pc + 1;
+  tos = *--sp;
+  goto *tab[*pc++];
+JumpL:
+  pc = tos ? pc - 1 + ant3_rel16(pc) : pc + 2;
+  tos = *--sp;
+  goto *tab[*pc++];
+PushI8:
+  *sp++ = tos;
+  tos = ant3_int(pc, 1);
+  pc += 1;
+  goto *tab[*pc++];
+PushI16:
+  *sp++ = tos;
+  tos = ant3_int(pc, 2);
+  pc += 2;
+  goto *tab[*pc++];
+PushI32:
+  *sp++ = tos;
+  tos = ant3_int(pc, 4);
+  pc += 4;
+  goto *tab[*pc++];
+PushI64:
+  *sp++ = tos;
+  tos = ant3_int(pc, 8);
+  pc += 8;
+  goto *tab[*pc++];
+CallNative:
+  *sp++ = tos, sp -= pc[1];
+  tos = ant3_call(&ant->fns[pc[0]], sp, pc[1]);
+  pc += 2;
+  goto *tab[*pc++];
+Func:
+  pc = pc - 1 + ant3_rel16(&pc[1]);
+  goto *tab[*pc++];
+Call:
+  rets[fp++] = pc + 3;
+  pc = pc - 1 + ant3_rel16(pc);
+  goto *tab[*pc++];
+Ret:
+  sp -= *pc;
+  pc = rets[--fp];
+  goto *tab[*pc++];
+Nip:
+  sp -= *pc++;
+  goto *tab[*pc++];
+Pick:
+  *sp++ = tos;
+  tos = sp[-*pc++];
+  goto *tab[*pc++];
+Done:
+  *sp = tos;
+  ant->sp = (int) (sp - stk);
+  memcpy(ant->stack, &stk[1], (size_t) ant->sp * sizeof(*sp));
+  return ant->sp > 0 ? ant->stack[0] : 0;
+}
+
+// Direct threaded code: instruction cell holds handler address, followed by
+// operand cells. Jump operands point straight to the target cell
+union ant3_cell {
+  const void *op;              // Handler address
+  const union ant3_cell *jmp;  // Jump target
+  size_t arg;                  // Variable or immediate index
+  antval_t val;                // Inline value
+};
+
+// Execute direct threaded code created by ant3_link(), using top-of-stack
+// caching like ant3_eval_tos(). If `labels` is not NULL, store the handler
+// address table into it and return
+static inline antval_t ant3_threaded(struct ant3 *ant,
+                                     const union ant3_cell *pc,
+                                     const void *const **labels) {
+  static const void *const tab[] = {
+      &&Done,         &&IncVar,       &&Assign,       &&PushVar,
+      &&PopVar,       &&PushImm,      &&Plus,         &&Div,
+      &&Pop,          &&CmpVarImm,    &&Jump,         &&Minus,
+      &&Mul,          &&Equal,        &&Less,         &&More,
+      &&AddVarVar,    &&DivVarImm,    &&AccumVar,     &&JumpVarLtVar,
+      &&JumpVarLtImm, &&JumpVarNeImm, &&DivMagic,     &&Jump,
+      &&Jump,         &&PushI,        &&PushI,        &&PushI,
+      &&PushI,        &&CallNative,   &&Func,         &&Call,
+      &&Ret,          &&Pick,         &&Nip};
+  const union ant3_cell *rets[ANT3_FRAMES];
+  antval_t stk[11], *sp = stk, tos = 0, *vars, *imm;
+  int fp = 0;
+  if (labels != NULL) {
+    *labels = tab;
+    return 0;
+  }
+  vars = ant->vars, imm = ant->imm;
+  memcpy(&stk[1], ant->stack, sizeof(ant->stack));
+  goto *(pc++)->op;
+IncVar:
+  vars[(pc++)->arg]++;
+  goto *(pc++)->op;
+Assign:
+  vars[pc[0].arg] = imm[pc[1].arg];
+  pc += 2;
+  goto *(pc++)->op;
+PushVar:
+  *sp++ = tos;
+  tos = vars[(pc++)->arg];
+  goto *(pc++)->op;
+PopVar:
+  vars[(pc++)->arg] = tos;
+  tos = *--sp;
+  goto *(pc++)->op;
+PushImm:
+  *sp++ = tos;
+  tos = imm[(pc++)->arg];
+  goto *(pc++)->op;
+PushI:
+  *sp++ = tos;
+  tos = (pc++)->val;
+  goto *(pc++)->op;
+CallNative:
+  *sp++ = tos, sp -= pc[1].arg;
+  tos = ant3_call(&ant->fns[pc[0].arg], sp, (int) pc[1].arg);
+  pc += 2;
+  goto *(pc++)->op;
+Func:
+  pc = pc[1].jmp;
+  goto *(pc++)->op;
+Call:
+  rets[fp++] = pc + 2;
+  pc = pc[0].jmp;
+  goto *(pc++)->op;
+Ret:
+  sp -= pc->arg;
+  pc = rets[--fp];
+  goto *(pc++)->op;
+Nip:
+  sp -= (pc++)->arg;
+  goto *(pc++)->op;
+Pick:
+  *sp++ = tos;
+  tos = *(sp - (pc++)->arg);
+  goto *(pc++)->op;
+Plus:
+  tos = *--sp + tos;
+  goto *(pc++)->op;
+Div:
+  tos = *--sp / tos;
+  goto *(pc++)->op;
+Minus:
+  tos = *--sp - tos;
+  goto *(pc++)->op;
+Mul:
+  tos = *--sp * tos;
+  goto *(pc++)->op;
+Equal:
+  tos = *--sp == tos ? 1 : 0;
+  goto *(pc++)->op;
+Less:
+  tos = *--sp < tos ? 1 : 0;
+  goto *(pc++)->op;
+More:
+  tos = *--sp > tos ? 1 : 0;
+  goto *(pc++)->op;
+Pop:
+  tos = *--sp;
+  goto *(pc++)->op;
+CmpVarImm:
+  *sp++ = tos;
+  tos = vars[pc[0].arg] - imm[pc[1].arg];
+  pc += 2;
+  goto *(pc++)->op;
+Jump:
+  pc = tos ? pc->jmp : pc + 1;
+  tos = *--sp;
+  goto *(pc++)->op;
+AddVarVar:
+  *sp++ = tos;
+  tos = vars[pc[0].arg] + vars[pc[1].arg];
+  pc += 2;
+  goto *(pc++)->op;
+DivVarImm:
+  *sp++ = tos;
+  tos = vars[pc[0].arg] / imm[pc[1].arg];
+  pc += 2;
+  goto *(pc++)->op;
+DivMagic:
+  tos = ant3_divmagic(tos, imm[pc[0].arg], (uint8_t) pc[1].arg);
+  pc += 2;
+  goto *(pc++)->op;
+AccumVar:
+  vars[(pc++)->arg] += tos;
+  tos = *--sp;
+  goto *(pc++)->op;
+JumpVarLtVar:
+  pc = vars[pc[0].arg] < vars[pc[1].arg] ? pc[2].jmp : pc + 3;
+  goto *(pc++)->op;
+JumpVarLtImm:
+  pc = vars[pc[0].arg] < imm[pc[1].arg] ? pc[2].jmp : pc + 3;
+  goto *(pc++)->op;
+JumpVarNeImm:
+  pc = vars[pc[0].arg] != imm[pc[1].arg] ? pc[2].jmp : pc + 3;
+  goto *(pc++)->op;
+Done:
+  *sp = tos;
+  ant->sp = (int) (sp - stk);
+  memcpy(ant->stack, &stk[1], (size_t) ant->sp * sizeof(*sp));
+  return ant->sp > 0 ? ant->stack[0] : 0;
+}
+
+// Return index of the cell that holds instruction at code[ofs]
+static inline size_t ant3_cell(const uint8_t *code, size_t ofs) {
+  size_t i, n = 0;
+  for (i = 0; i < ofs && code[i] != Done; i += ant3_oplen(&code[i])) {
+    n += 1 + strlen(ant3_op(code[i])->args);
+  }
+  return n;
+}
+
+// Convert ant3 bytecode into direct threaded code, so that dispatch does
+// not need to look up the handler table. Return the number of cells
+// written into `cells`, or 0 on error
+static inline size_t ant3_link(const uint8_t *code, union ant3_cell *cells,
+                               size_t len) {
+  const void *const *tab;
+  size_t i, k, n = 0;
+  ant3_threaded(NULL, NULL, &tab);
+  for (i = 0;; i += ant3_oplen(&code[i])) {
+    const struct ant3_op *op = ant3_op(code[i]);
+    if (op == NULL || n + 1 + strlen(op->args) > len) return 0;
+    cells[n++].op = tab[code[i]];
+    for (k = 0; op->args[k] != '\0'; k++, n++) {
+      const uint8_t *arg = &code[i + ant3_argofs(&code[i], k)];
+      if (strchr("trR", op->args[k]) != NULL) {
+        cells[n].jmp = &cells[ant3_cell(code, (size_t) ant3_target(code, i))];
+      } else if (strchr("1248", op->args[k]) != NULL) {
+        cells[n].val = ant3_int(arg, ant3_argsize(op->args[k]));
+      } else {
+        cells[n].arg = *arg;
+      }
+    }
+    if (code[i] == Done) break;
+  }
+  return n;
+}
+
+// Execute direct threaded code created by ant3_link()
+static inline antval_t ant3_eval_linked(struct ant3 *ant,
+                                        const union ant3_cell *cells) {
+  return ant3_threaded(ant, cells, NULL);
+}
+#endif  // __GNUC__ or __clang__
+
+// Tail call dispatch: each opcode is a separate function that ends with a
+// guaranteed tail call to the next handler. pc, sp and vars are passed as
+// arguments, so they stay in registers. Falls back to ant3_eval() if the
+// compiler does not support musttail. To force tail call engine with plain
+// tail calls, define ANT3_MUSTTAIL to nothing. Then only an optimising build
+// (e.g. -O2) turns the calls into jumps; without optimisation every executed
+// instruction adds a native stack frame, and long runs overflow the stack
+#if !defined(ANT3_MUSTTAIL) && defined(__has_attribute)
+#if __has_attribute(musttail)
+#define ANT3_MUSTTAIL __attribute__((musttail))
+#endif
+#endif
+
+#ifdef ANT3_MUSTTAIL
+typedef antval_t (*ant3_tail_t)(struct ant3 *, const uint8_t *pc,
+                                antval_t *sp, antval_t *vars,
+                                const uint8_t *base);
+static inline const ant3_tail_t *ant3_tails(void);
+
+#define ANT3_TAIL(name)                                                  \
+  static antval_t ant3_tail_##name(struct ant3 *ant, const uint8_t *pc, \
+                                   antval_t *sp, antval_t *vars,        \
+                                   const uint8_t *base)
+#define ANT3_NEXT \
+  ANT3_MUSTTAIL return ant3_tails()[*pc](ant, pc + 1, sp, vars, base)
+
+ANT3_TAIL(Done) {
+  (void) pc, (void) vars, (void) base;
+  ant->sp = (int) (sp - ant->stack);
+  return ant->sp > 0 ? ant->stack[0] : 0;
+}
+ANT3_TAIL(IncVar) {
+  vars[*pc++]++;
+  ANT3_NEXT;
+}
+ANT3_TAIL(Assign) {
+  vars[pc[0]] = ant->imm[pc[1]];
+  pc += 2;
+  ANT3_NEXT;
+}
+ANT3_TAIL(PushVar) {
+  *sp++ = vars[*pc++];
+  ANT3_NEXT;
+}
+ANT3_TAIL(PopVar) {
+  vars[*pc++] = *--sp;
+  ANT3_NEXT;
+}
+ANT3_TAIL(PushImm) {
+  *sp++ = ant->imm[*pc++];
+  ANT3_NEXT;
+}
+ANT3_TAIL(Plus) {
+  sp--, sp[-1] += sp[0];
+  ANT3_NEXT;
+}
+ANT3_TAIL(Div) {
+  sp--, sp[-1] /= sp[0];
+  ANT3_NEXT;
+}
+ANT3_TAIL(Pop) {
+  sp--;
+  ANT3_NEXT;
+}
+ANT3_TAIL(CmpVarImm) {
+  *sp++ = vars[pc[0]] - ant->imm[pc[1]];
+  pc += 2;
+  ANT3_NEXT;
+}
+ANT3_TAIL(Jump) {
+  pc = *--sp ? base + pc[0] : pc + 1;
+  ANT3_NEXT;
+}
+ANT3_TAIL(Minus) {
+  sp--, sp[-1] -= sp[0];
+  ANT3_NEXT;
+}
+ANT3_TAIL(Mul) {
+  sp--, sp[-1] *= sp[0];
+  ANT3_NEXT;
+}
+ANT3_TAIL(Equal) {
+  sp--, sp[-1] = sp[-1] == sp[0] ? 1 : 0;
+  ANT3_NEXT;
+}
+ANT3_TAIL(Less) {
+  sp--, sp[-1] = sp[-1] < sp[0] ? 1 : 0;
+  ANT3_NEXT;
+}
+ANT3_TAIL(More) {
+  sp--, sp[-1] = sp[-1] > sp[0] ? 1 : 0;
+  ANT3_NEXT;
+}
+ANT3_TAIL(AddVarVar) {
+  *sp++ = vars[pc[0]] + vars[pc[1]];
+  pc += 2;
+  ANT3_NEXT;
+}
+ANT3_TAIL(DivVarImm) {
+  *sp++ = vars[pc[0]] / ant->imm[pc[1]];
+  pc += 2;
+  ANT3_NEXT;
+}
+ANT3_TAIL(DivMagic) {
+  sp[-1] = ant3_divmagic(sp[-1], ant->imm[pc[0]], pc[1]);
+  pc += 2;
+  ANT3_NEXT;
+}
+ANT3_TAIL(AccumVar) {
+  vars[*pc++] += *--sp;
+  ANT3_NEXT;
+}
+ANT3_TAIL(JumpVarLtVar) {
+  pc = vars[pc[0]] < vars[pc[1]] ? pc - 1 + ant3_rel16(&pc[2]) : pc + 4;
+  ANT3_NEXT;
+}
+ANT3_TAIL(JumpVarLtImm) {
+  pc = vars[pc[0]] < ant->imm[pc[1]] ? pc - 1 + ant3_rel16(&pc[2]) : pc + 4;
+  ANT3_NEXT;
+}
+ANT3_TAIL(JumpVarNeImm) {
+  pc = vars[pc[0]] != ant->imm[pc[1]] ? pc - 1 + ant3_rel16(&pc[2]) : pc + 4;
+  ANT3_NEXT;
+}
+ANT3_TAIL(JumpS) {
+  pc = *--sp ? pc - 1 + ant3_rel8(pc) : pc + 1;
+  ANT3_NEXT;
+}
+ANT3_TAIL(JumpL) {
+  pc = *--sp ? pc - 1 + ant3_rel16(pc) : pc + 2;
+  ANT3_NEXT;
+}
+ANT3_TAIL(PushI8) {
+  *sp++ = ant3_int(pc, 1);
+  pc += 1;
+  ANT3_NEXT;
+}
+ANT3_TAIL(PushI16) {
+  *sp++ = ant3_int(pc, 2);
+  pc += 2;
+  ANT3_NEXT;
+}
+ANT3_TAIL(PushI32) {
+  *sp++ = ant3_int(pc, 4);
+  pc += 4;
+  ANT3_NEXT;
+}
+ANT3_TAIL(PushI64) {
+  *sp++ = ant3_int(pc, 8);
+  pc += 8;
+  ANT3_NEXT;
+}
+ANT3_TAIL(CallNative) {
+  sp -= pc[1];
+  *sp = ant3_call(&ant->fns[pc[0]], sp, pc[1]);
+  sp++, pc += 2;
+  ANT3_NEXT;
+}
+ANT3_TAIL(Func) {
+  pc = pc - 1 + ant3_rel16(&pc[1]);
+  ANT3_NEXT;
+}
+// The callee runs in a nested, non-tail call, which returns on Ret.
+// ant3_verify() bounds the nesting depth
+ANT3_TAIL(Call) {
+  const uint8_t *body = pc - 1 + ant3_rel16(pc);
+  ant3_tails()[*body](ant, body + 1, sp, vars, base);
+  sp = &ant->stack[ant->sp], pc += 3;
+  ANT3_NEXT;
+}
+ANT3_TAIL(Ret) {
+  (void) vars, (void) base;
+  sp[-1 - *pc] = sp[-1];
+  ant->sp = (int) (sp - *pc - ant->stack);
+  return 0;
+}
+ANT3_TAIL(Nip) {
+  sp[-1 - *pc] = sp[-1];
+  sp -= *pc++;
+  ANT3_NEXT;
+}
+ANT3_TAIL(Pick) {
+  *sp = sp[-*pc++];
+  sp++;
+  ANT3_NEXT;
+}
+
+static inline const ant3_tail_t *ant3_tails(void) {
+  static const ant3_tail_t tab[] = {
+      ant3_tail_Done,         ant3_tail_IncVar,       ant3_tail_Assign,
+      ant3_tail_PushVar,      ant3_tail_PopVar,       ant3_tail_PushImm,
+      ant3_tail_Plus,         ant3_tail_Div,          ant3_tail_Pop,
+      ant3_tail_CmpVarImm,    ant3_tail_Jump,         ant3_tail_Minus,
+      ant3_tail_Mul,          ant3_tail_Equal,        ant3_tail_Less,
+      ant3_tail_More,         ant3_tail_AddVarVar,    ant3_tail_DivVarImm,
+      ant3_tail_AccumVar,     ant3_tail_JumpVarLtVar, ant3_tail_JumpVarLtImm,
+      ant3_tail_JumpVarNeImm, ant3_tail_DivMagic,     ant3_tail_JumpS,
+      ant3_tail_JumpL,        ant3_tail_PushI8,       ant3_tail_PushI16,
+      ant3_tail_PushI32,      ant3_tail_PushI64,      ant3_tail_CallNative,
+      ant3_tail_Func,         ant3_tail_Call,         ant3_tail_Ret,
+      ant3_tail_Pick,         ant3_tail_Nip};
+  return tab;
+}
+
+static inline antval_t ant3_eval_tail(struct ant3 *ant,
+                                      const unsigned char *pc) {
+  return ant3_tails()[*pc](ant, pc + 1, ant->stack, ant->vars, pc);
+}
+#else
+static inline antval_t ant3_eval_tail(struct ant3 *ant,
+                                      const unsigned char *pc) {
+  return ant3_eval(ant, pc);
+}
+#endif  // ANT3_MUSTTAIL
+
+/////////////////////////////////////////////// ANT, ANT2 -> ANT3 COMPILER
+// Compiles infix ant or postfix ant2 source into ant3 bytecode, so that the
+// parsing cost is paid once. Literals are stored into the ant3 imm[] table.
+// The code ends with exactly one value on the stack, which Done returns: for
+// infix source, the value of the last expression statement that ran, or 0,
+// like ant_eval() returns it. For postfix source, the last value that was at
+// the bottom of the stack, like ant2_eval() returns it
+
+// Script function defined by `fn name(args) { ... }`
+struct antc_fn {
+  const char *name;  // Function name, points into the source
+  int len, nargs;    // Name length, number of arguments
+  int ofs;           // Code offset of the body, or -1 if it is inlined
+  int need, frames;  // Stack depth and call frames used by a call
+  uint8_t body[16];  // Inlined body, without Ret
+  int size;          // Inlined body size
+};
+
+struct antc {
+  struct ant lex;   // Tokenizer state, reuses ant_next()
+  struct ant3 *vm;  // Target VM, receives immediate values
+  uint8_t *code;    // Output buffer
+  size_t len, n;    // Output buffer size, number of bytes emitted
+  int nimm;         // Number of used immediates
+  int depth;        // Current stack depth
+  int pending;      // Expression value is left on stack
+  int track;        // Result is kept on stack across jumps, see antc_result()
+  int label;        // Code offset of the last label
+  int fwd;          // 1 + offset of the last forward jump, 0 if none
+  const char *names[ANT3_VARS];  // Variable names, point into the source
+  uint8_t lens[ANT3_VARS];       // Variable name lengths
+  int nvars;                     // Number of variables
+  int max, frames;               // Maximum stack depth and call frames
+  struct antc_fn fns[ANT3_FUNCS];  // Script functions
+  int nfns;                        // Number of script functions
+  struct antc_fn *fn;              // Function being compiled, or NULL
+  const char *args[8];             // Its argument names
+  int arglens[8];                  // Its argument name lengths
+  struct ant3_map *map;            // Source positions, or NULL
+};
+
+static inline void antc_emit(struct antc *c, int byte, int stack_effect) {
+  if (c->n < c->len) c->code[c->n] = (uint8_t) byte;
+  c->n++;
+  c->depth += stack_effect;
+  if (c->depth > c->max) c->max = c->depth;
+  if (c->depth > (int) (sizeof(c->vm->stack) / sizeof(c->vm->stack[0])))
+    ant_err(&c->lex, "%s", "stack overflow");
+}
+
+// Emit a literal. Values that fit into 32 bits are inlined, larger ones go
+// to the deduplicated imm[] pool. If the pool is full, use PushI64
+static inline void antc_emit_imm(struct antc *c, antval_t val) {
+  uint8_t buf[9];
+  size_t k, n = ant3_pushi(buf, val);
+  int i;
+  for (i = 0; i < c->nimm && c->vm->imm[i] != val; i++) (void) 0;
+  if (n > 5 && i < (int) (sizeof(c->vm->imm) / sizeof(c->vm->imm[0]))) {
+    if (i == c->nimm) c->vm->imm[c->nimm++] = val;
+    antc_emit(c, PushImm, 1);
+    antc_emit(c, i, 0);
+  } else {
+    antc_emit(c, buf[0], 1);
+    for (k = 1; k < n; k++) antc_emit(c, buf[k], 0);
+  }
+}
+
+static inline void antc_emit_var(struct antc *c, int op, antval_t idx) {
+  antval_t nvars = (antval_t) (sizeof(c->vm->vars) / sizeof(c->vm->vars[0]));
+  if (idx < 0 || idx >= nvars) {
+    ant_err(&c->lex, "%s", "bad variable");
+  } else {
+    antc_emit(c, op, op == PushVar ? 1 : op == PopVar ? -1 : 0);
+    antc_emit(c, (int) idx, 0);
+  }
+}
+
+// Emit JumpL, ant3_relax() turns it into JumpS later if the target is close
+static inline void antc_emit_jump(struct antc *c, int target) {
+  long d = target - (long) c->n;
+  if (d < -32768 || d > 32767) ant_err(&c->lex, "%s", "code too big");
+  antc_emit(c, JumpL, -1);
+  antc_emit(c, (int) (d & 255), 0);
+  antc_emit(c, (int) ((unsigned long) d >> 8 & 255), 0);
+}
+
+// ant_next() reads one letter of an identifier. Read the rest of it and
+// return identifier length
+static inline int antc_name(struct antc *c) {
+  const char *name = c->lex.pc - 1;
+  c->lex.pc = ant_skip_ident(c->lex.pc, c->lex.eof);
+  return (int) (c->lex.pc - name);
+}
+
+// Return variable index for identifier `name` of length `len`, adding a new
+// variable if it is first seen
+static inline int antc_intern(struct antc *c, const char *name, int len) {
+  int i;
+  for (i = 0; i < c->nvars; i++) {
+    if (c->lens[i] == len && memcmp(c->names[i], name, (size_t) len) == 0) {
+      return i;
+    }
+  }
+  if (c->nvars >= ANT3_VARS || len > 255) {
+    ant_err(&c->lex, "%s", "too many vars");
+    return 0;
+  }
+  c->names[c->nvars] = name, c->lens[c->nvars] = (uint8_t) len;
+  return c->nvars++;
+}
+
+// Return argument index of identifier `name` in the function being
+// compiled, or -1 if it is not an argument
+static inline int antc_param(const struct antc *c, const char *name, int len) {
+  int i;
+  for (i = 0; c->fn != NULL && i < c->fn->nargs; i++) {
+    if (c->arglens[i] == len && memcmp(c->args[i], name, (size_t) len) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Push a copy of argument `i`. Arguments are addressed from the stack top,
+// function body starts with its arguments on the stack
+static inline void antc_pick(struct antc *c, int i) {
+  int k = c->depth - i;
+  antc_emit(c, Pick, 1);
+  antc_emit(c, k, 0);
+}
+
+// Inline function `f`, replacing each argument read by a copy of the
+// instruction that pushed the argument, so that arguments do not stay on the
+// stack. Arguments were emitted at code offsets `args`. This applies when
+// every argument is a single pure push, and the body has no jumps, stores or
+// native calls. Return 0 if it does not apply
+static inline int antc_subst(struct antc *c, const struct antc_fn *f,
+                             const int *args) {
+  uint8_t arg[8][9];
+  int i, k, depth = f->nargs, len[8];
+  if (f->nargs == 0) return 0;
+  for (i = 0; i < f->nargs && c->n <= c->len; i++) {
+    const uint8_t *p = &c->code[args[i]];
+    const struct ant3_op *op = ant3_op(*p);
+    len[i] = (i + 1 < f->nargs ? args[i + 1] : (int) c->n) - args[i];
+    if (!ant3_pure(*p) || op->pop != 0 || op->push != 1 ||
+        len[i] != (int) ant3_oplen(p)) {
+      return 0;
+    }
+    memcpy(arg[i], p, (size_t) len[i]);
+  }
+  if (i < f->nargs) return 0;
+  for (k = 0; k < f->size; k += (int) ant3_oplen(&f->body[k])) {
+    if (strpbrk(ant3_op(f->body[k])->args, "VtrR") != NULL ||
+        f->body[k] == CallNative) {
+      return 0;
+    }
+  }
+  c->n = (size_t) args[0], c->depth -= f->nargs;
+  for (k = 0; k < f->size; k += (int) ant3_oplen(&f->body[k])) {
+    const uint8_t *p = &f->body[k];
+    int n = (int) ant3_oplen(p), j;
+    if (*p == Pick && depth - p[1] < f->nargs) {
+      for (j = 0; j < len[depth - p[1]]; j++) {
+        antc_emit(c, arg[depth - p[1]][j], 0);
+      }
+    } else {
+      for (j = 0; j < n; j++) antc_emit(c, p[j], 0);
+    }
+    depth += ant3_op(*p)->push - ant3_pops(p);
+  }
+  c->depth++;
+  return 1;
+}
+
+// Emit a call of script function `f`, with arguments already emitted at code
+// offsets `args`. An inlined function gets its body copied, followed by Nip
+// of the arguments
+static inline void antc_call_fn(struct antc *c, const struct antc_fn *f,
+                                const int *args) {
+  int i, need = c->depth - f->nargs + f->need;
+  long d = f->ofs - (long) c->n;
+  if (need > c->max) c->max = need;
+  if (f->ofs >= 0 && f->frames + 1 > c->frames) c->frames = f->frames + 1;
+  if (need > (int) (sizeof(c->vm->stack) / sizeof(c->vm->stack[0])) ||
+      c->frames > ANT3_FRAMES) {
+    ant_err(&c->lex, "%s", "stack overflow");
+  }
+  if (f->ofs < 0 && !antc_subst(c, f, args)) {
+    for (i = 0; i < f->size; i++) antc_emit(c, f->body[i], 0);
+    c->depth++;
+    if (f->nargs > 0) antc_emit(c, Nip, -f->nargs), antc_emit(c, f->nargs, 0);
+  }
+  if (f->ofs < 0) return;
+  if (d < -32768) ant_err(&c->lex, "%s", "code too big");
+  antc_emit(c, Call, 1 - f->nargs);
+  antc_emit(c, (int) (d & 255), 0);
+  antc_emit(c, (int) ((unsigned long) d >> 8 & 255), 0);
+  antc_emit(c, f->nargs, 0);
+}
+
+static void antc_expr(struct antc *c);
+
+// Compile a call: comma separated arguments in parenthesis. Script
+// functions are looked up first, then native ones in `vm->fns`
+static inline void antc_call(struct antc *c, const char *name, int len) {
+  const struct ant3_fn *f = c->vm->fns;
+  struct antc_fn *s = c->fns;
+  int i, nargs = 0, args[8];
+  while (s < &c->fns[c->nfns] &&
+         (s->len != len || memcmp(s->name, name, (size_t) len) != 0)) {
+    s++;
+  }
+  for (i = 0; f != NULL && f[i].name != NULL; i++) {
+    if (strlen(f[i].name) == (size_t) len &&
+        memcmp(f[i].name, name, (size_t) len) == 0) {
+      break;
+    }
+  }
+  ant_checktok(&c->lex, '(', Inv);
+  if (ant_isnext(&c->lex, ')', Inv) == Inv) {
+    do {
+      if (nargs < 8) args[nargs] = (int) c->n;
+      antc_expr(c);
+      nargs++;
+    } while (ant_isnext(&c->lex, ',', Inv) != Inv);
+    ant_checktok(&c->lex, ')', Inv);
+  }
+  if (s < &c->fns[c->nfns]) {
+    if (s->nargs != nargs) {
+      ant_err(&c->lex, "%s", "bad call");
+    } else {
+      antc_call_fn(c, s, args);
+    }
+  } else if (f == NULL || f[i].name == NULL || i > 255 ||
+             (f[i].nargs >= 0 && f[i].nargs != nargs)) {
+    ant_err(&c->lex, "%s", "bad call");
+  } else {
+    antc_emit(c, CallNative, 1 - nargs);
+    antc_emit(c, i, 0);
+    antc_emit(c, nargs, 0);
+  }
+}
+
+static inline void antc_primary(struct antc *c) {
+  int tok = ant_next(&c->lex);
+  ant_swallow(&c->lex);
+  if (tok == '(') {
+    antc_expr(c);
+    ant_checktok(&c->lex, ')', Inv);
+  } else if (tok == Num) {
+    antc_emit_imm(c, c->lex.val);
+  } else if (tok == Var) {
+    const char *name = c->lex.pc - 1;
+    int len = antc_name(c);
+    int arg = antc_param(c, name, len);
+    if (ant_next(&c->lex) == '(') {
+      antc_call(c, name, len);
+    } else if (arg >= 0) {
+      antc_pick(c, arg);
+    } else {
+      antc_emit_var(c, PushVar, antc_intern(c, name, len));
+    }
+  } else {
+    ant_err(&c->lex, "%s", "parse error");
+  }
+}
+
+static inline void antc_mul_or_div(struct antc *c);
+static inline void antc_mul_or_div2(struct antc *c) {
+  int tok = ant_isnext(&c->lex, '*', '/');
+  if (tok != Inv) {
+    antc_mul_or_div(c);
+    antc_emit(c, tok == '*' ? Mul : Div, -1);
+  }
+}
+
+static inline void antc_mul_or_div(struct antc *c) {
+  antc_primary(c);
+  antc_mul_or_div2(c);
+}
+
+static inline void antc_add_or_sub2(struct antc *c) {
+  int tok = ant_isnext(&c->lex, '+', '-');
+  if (tok != Inv) {
+    antc_mul_or_div(c);
+    antc_add_or_sub2(c);
+    antc_emit(c, tok == '+' ? Plus : Minus, -1);
+  }
+}
+
+static inline void antc_eq_more_less2(struct antc *c) {
+  int tok = ant_isnext(&c->lex, Eq, '<');
+  if (tok == Inv) tok = ant_isnext(&c->lex, '>', Inv);
+  if (tok != Inv) {
+    antc_expr(c);
+    antc_emit(c, tok == Eq ? Equal : tok == '<' ? Less : More, -1);
+  }
+}
+
+static inline void antc_assignment(struct antc *c) {
+  if (ant_isnext(&c->lex, Var, Inv) != Inv) {
+    const char *name = c->lex.pc - 1;
+    int len = antc_name(c), arg = antc_param(c, name, len), tok;
+    if (ant_next(&c->lex) == '(') {
+      antc_call(c, name, len);
+    } else if (arg >= 0) {
+      antc_pick(c, arg);  // Arguments are read-only
+    } else {
+      antval_t idx = antc_intern(c, name, len);
+      tok = ant_isnext(&c->lex, '=', Inc);
+      if (tok == Inv) tok = ant_isnext(&c->lex, Dec, Inv);
+      if (tok != Inv) {
+        if (tok != '=') antc_emit_var(c, PushVar, idx);
+        antc_expr(c);
+        if (tok != '=') antc_emit(c, tok == Inc ? Plus : Minus, -1);
+        antc_emit_var(c, PopVar, idx);
+        antc_emit_var(c, PushVar, idx);
+        return;
+      }
+      antc_emit_var(c, PushVar, idx);
+    }
+    antc_mul_or_div2(c);
+  } else {
+    antc_mul_or_div(c);
+  }
+  antc_add_or_sub2(c);
+  antc_eq_more_less2(c);
+}
+
+static inline void antc_expr(struct antc *c) {
+  antc_assignment(c);
+}
+
+// Map the code emitted next to source position `p`
+static inline void antc_pos(struct antc *c, const char *p) {
+  if (c->map != NULL && c->n <= c->len) {
+    ant3_map_add(c->map, c->code, c->n, (size_t) (p - c->lex.buf));
+  }
+}
+
+// Drop the value of the previous expression statement from the stack
+static inline void antc_flush(struct antc *c) {
+  if (c->pending) antc_emit(c, Pop, -1);
+  c->pending = 0;
+}
+
+// If the program does not end with an expression statement, its result is
+// not known at compile time. Then it is compiled again with `track` set: the
+// result stays on the stack under jump conditions, 0 until an expression
+// statement runs, and an expression statement replaces it
+static inline void antc_result(struct antc *c) {
+  if (!c->pending) antc_emit_imm(c, 0);
+  c->pending = 1;
+}
+
+// Point forward jumps to the current offset. They are chained like in
+// ant4_label(): the operand of each one holds the `fwd` of the one before
+static inline void antc_patch(struct antc *c) {
+  while (c->fwd > 0 && c->fwd + 1 < (int) c->len) {
+    int ofs = c->fwd - 1;
+    c->fwd = c->code[ofs + 1] | c->code[ofs + 2] << 8;
+    if (!ant3_set_target(c->code, (size_t) ofs, c->n)) {
+      ant_err(&c->lex, "%s", "code too big");
+    }
+  }
+  c->fwd = 0;
+}
+
+static inline void antc_label(struct antc *c) {
+  antc_patch(c);
+  c->label = (int) c->n;
+}
+
+// Emit a jump to the nearest label: backward one is already known, forward
+// one gets patched when the next label is seen
+static inline void antc_jump(struct antc *c, int back) {
+  if (back) {
+    antc_emit_jump(c, c->label);
+  } else if (c->n >= 0xffff) {
+    ant_err(&c->lex, "%s", "code too big");
+  } else {
+    int at = (int) c->n;
+    antc_emit(c, JumpL, -1);
+    antc_emit(c, c->fwd & 255, 0), antc_emit(c, c->fwd >> 8, 0);
+    c->fwd = at + 1;
+  }
+}
+
+// Return true if the identifier that ant_next() has started is `fn`
+static inline int antc_is_fn(const struct antc *c) {
+  const char *p = c->lex.pc;
+  return p[-1] == 'f' && p[0] == 'n' && !ant_is(p[1], ANT_CIDENT);
+}
+
+// Parse the rest of a function head "fn name(a, b) {" into `f`, make it
+// the function being compiled
+static inline void antc_fn_head(struct antc *c, struct antc_fn *f) {
+  memset(f, 0, sizeof(*f));
+  c->lex.pc++;  // Skip 'n' of the keyword
+  if (ant_checktok(&c->lex, Var, Inv) == Var) {
+    f->name = c->lex.pc - 1, f->len = antc_name(c);
+  }
+  ant_checktok(&c->lex, '(', Inv);
+  if (ant_isnext(&c->lex, ')', Inv) == Inv) {
+    do {
+      if (ant_checktok(&c->lex, Var, Inv) == Inv) break;
+      if (f->nargs >= (int) (sizeof(c->args) / sizeof(c->args[0]))) {
+        ant_err(&c->lex, "%s", "too many args");
+        break;
+      }
+      c->args[f->nargs] = c->lex.pc - 1;
+      c->arglens[f->nargs++] = antc_name(c);
+    } while (ant_isnext(&c->lex, ',', Inv) != Inv);
+    ant_checktok(&c->lex, ')', Inv);
+  }
+  ant_checktok(&c->lex, '{', Inv);
+  c->fn = f;
+}
+
+static inline void antc_stmt_list(struct antc *c);
+
+// Compile function definition "fn name(a, b) { statements }". Function
+// returns the value of its last expression statement, or 0. Labels and
+// jumps are local to the function. Calls can only go to functions defined
+// before, so there is no recursion. A function without calls and with a
+// short body is not emitted: it is inlined at every call site
+static inline void antc_func(struct antc *c) {
+  struct antc_fn *f = &c->fns[c->nfns < ANT3_FUNCS ? c->nfns : 0];
+  int depth = c->depth, max = c->max, frames = c->frames, label = c->label;
+  int fwd = c->fwd, start = (int) c->n, i;
+  int pending = c->pending, track = c->track;
+  struct ant3_map map;
+  if (c->map != NULL) map = *c->map;
+  if (c->fn != NULL || c->nfns >= ANT3_FUNCS) {
+    ant_err(&c->lex, "%s", "bad function");
+    return;
+  }
+  antc_fn_head(c, f);
+  c->depth = c->max = f->nargs, c->frames = c->fwd = 0;
+  c->pending = c->track = 0;
+  antc_emit(c, Func, 0), antc_emit(c, f->nargs, 0);
+  antc_emit(c, 0, 0), antc_emit(c, 0, 0);  // Patched below
+  c->label = f->ofs = (int) c->n;
+  antc_stmt_list(c);
+  ant_checktok(&c->lex, '}', Inv);
+  if (c->fwd > 0) ant_err(&c->lex, "%s", "bad jump");
+  if (!c->pending) antc_emit_imm(c, 0);
+  antc_emit(c, Ret, -f->nargs), antc_emit(c, f->nargs, 0);
+  f->need = c->max, f->frames = c->frames;
+  for (i = f->ofs; i + 2 < (int) c->n && c->n <= c->len && c->code[i] != Call;
+       i += (int) ant3_oplen(&c->code[i])) {
+    (void) 0;  // Find a Call, or the Ret at the end
+  }
+  if (i + 2 == (int) c->n && i - f->ofs <= (int) sizeof(f->body)) {
+    f->size = i - f->ofs;
+    memcpy(f->body, &c->code[f->ofs], (size_t) f->size);
+    f->ofs = -1, c->n = (size_t) start;
+    if (c->map != NULL) *c->map = map;  // Forget the body's statements
+  } else if (start + 3 < (int) c->len &&
+             !ant3_set_target(c->code, (size_t) start, c->n)) {
+    ant_err(&c->lex, "%s", "code too big");
+  }
+  c->depth = depth, c->max = max, c->frames = frames, c->label = label;
+  c->fwd = fwd, c->fn = NULL, c->nfns++;
+  c->pending = pending, c->track = track;
+}
+
+static inline void antc_stmt_list(struct antc *c) {
+  int tok;
+  while ((tok = ant_next(&c->lex)) != Eof) {
+    if (tok == '}' && c->fn != NULL) break;  // End of function body
+    ant_swallow(&c->lex);
+    if (tok == ';') continue;
+    if (c->track && (tok == '#' || tok == '@')) {
+      antc_result(c);
+    } else if (!c->track || !(tok == Var && antc_is_fn(c))) {
+      antc_flush(c);
+    }
+    antc_pos(c, c->lex.pc - 1);  // Last byte of the first token
+    if (tok == Var && antc_is_fn(c)) {
+      antc_func(c);
+    } else if (tok == '#') {
+      antc_label(c);
+    } else if (tok == '@') {
+      int back = *c->lex.pc++ == 'b';
+      antc_expr(c);
+      antc_jump(c, back);
+    } else {
+      c->lex.tok = tok;  // Not a statement token, give it back to expression
+      antc_expr(c);
+      c->pending = 1;
+    }
+  }
+}
+
+static inline void antc_init(struct antc *c, const char *src, uint8_t *code,
+                             size_t len, struct ant3 *vm) {
+  memset(c, 0, sizeof(*c));
+  c->lex.pc = c->lex.buf = src;
+  c->lex.eof = &src[strlen(src)];
+  c->vm = vm;
+  c->code = code;
+  c->len = len;
+}
+
+static inline size_t antc_done(struct antc *c) {
+  antc_patch(c);
+  antc_emit(c, Done, 0);
+  return c->lex.err[0] != '\0' || c->n > c->len ? 0 : ant3_relax(c->code);
+}
+
+// Compile `src` with `list`, and add the source position of every statement
+// to `map`, if it is not NULL. If the code leaves no value on the stack, or
+// jumps to the end, the result depends on the path taken: compile again with
+// `track` set. Return code size, 0 on error or if the map does not fit into
+// its buffer
+static inline size_t antc_run(const char *src, uint8_t *code, size_t len,
+                              struct ant3 *vm, struct ant3_map *map,
+                              void (*list)(struct antc *)) {
+  struct antc c;
+  struct ant3_map saved;
+  if (map != NULL) saved = *map;
+  antc_init(&c, src, code, len, vm);
+  c.map = map;
+  list(&c);
+  if ((c.depth == 0 || c.fwd > 0) && c.lex.err[0] == '\0') {
+    antc_init(&c, src, code, len, vm);
+    c.map = map, c.track = 1;
+    if (map != NULL) *map = saved;
+    list(&c);
+    if (c.depth == 0) antc_emit_imm(&c, 0);  // No expression statement
+  }
+  len = antc_done(&c);
+  return map != NULL && map->len > map->size ? 0 : len;
+}
+
+// Compile infix source like ant_compile(), and add the source position of
+// every statement to `map`, if it is not NULL. Return code size, 0 on error
+// or if the map does not fit into its buffer
+static inline size_t ant_compile_map(const char *src, uint8_t *code,
+                                     size_t len, struct ant3 *vm,
+                                     struct ant3_map *map) {
+  return antc_run(src, code, len, vm, map, antc_stmt_list);
+}
+
+// Compile infix source `src` into ant3 bytecode. Immediate values are stored
+// into `vm->imm`. Variable names are letters, digits and underscores starting
+// with a lowercase letter, they get `vm->vars` slots in order of appearance.
+// `fn name(args...) { ... }` defines a function, see antc_func().
+// `name(args...)` calls a function defined before, or a native function
+// from `vm->fns`.
+// Return the size of generated code, or 0 on error
+static inline size_t ant_compile(const char *src, uint8_t *code, size_t len,
+                                 struct ant3 *vm) {
+  return ant_compile_map(src, code, len, vm, NULL);
+}
+
+// Return the `vm->vars` index that ant_compile() assigns to variable `name`
+// in source `src`, or -1 if `src` does not use it
+static inline int ant_var(const char *src, const char *name) {
+  struct ant3 vm;
+  struct antc c;
+  int tok, i;
+  antc_init(&c, src, NULL, 0, &vm);
+  while ((tok = ant_next(&c.lex)) != Eof) {
+    ant_swallow(&c.lex);
+    if (tok == '@') c.lex.pc++;  // Skip jump direction
+    if (tok == '}') c.fn = NULL;
+    if (tok == Var && antc_is_fn(&c)) {
+      antc_fn_head(&c, &c.fns[0]);
+    } else if (tok == Var) {
+      const char *name = c.lex.pc - 1;
+      int len = antc_name(&c);
+      if (ant_next(&c.lex) != '(' && antc_param(&c, name, len) < 0) {
+        antc_intern(&c, name, len);
+      }
+    }
+  }
+  for (i = 0; i < c.nvars; i++) {
+    if (strlen(name) == c.lens[i] && memcmp(c.names[i], name, c.lens[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// In tracking mode, the stack holds the result under the ant2 values. Before
+// an instruction pops the bottom ant2 value, make that value the result.
+// Return true if the value is popped already
+static inline int antc_keep(struct antc *c, int copy) {
+  if (!c->track || c->depth != 2) return 0;
+  antc_emit(c, Nip, -1), antc_emit(c, 1, 0);
+  if (copy) antc_emit(c, Pick, 1), antc_emit(c, 1, 0);
+  return !copy;
+}
+
+static inline void antc_postfix(struct antc *c) {
+  int stmt = 1;  // The next token starts a statement
+  if (c->track) antc_emit_imm(c, 0);
+  while (c->lex.pc < c->lex.eof) {
+    const char *p = c->lex.pc++;
+    if (stmt && !ant_is(*p, ANT_CSPACE)) antc_pos(c, p), stmt = 0;
+    // clang-format off
+    switch (*p) {
+      case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g':
+      case 'h': case 'i': case 'j': case 'k': case 'l': case 'm': case 'n':
+      case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+      case 'v': case 'w': case 'x': case 'y': case 'z':
+        antc_emit_var(c, PushVar, *p - 'a');
+        break;
+      case '0': case '1': case '2': case '3': case '4':
+      case '5': case '6': case '7': case '8': case '9':
+        antc_emit_imm(c, ant_num(p, c->lex.eof, &c->lex.pc));
+        break;
+      case '=':
+        antc_keep(c, 1);
+        antc_emit_var(c, PopVar, *c->lex.pc++ - 'a');
+        break;
+      case 'I': antc_emit_var(c, IncVar, *c->lex.pc++ - 'a'); break;
+      case '+': antc_emit(c, Plus, -1); break;
+      case '*': antc_emit(c, Mul, -1); break;
+      case '/': antc_emit(c, Div, -1); break;
+      case '<': antc_emit(c, Less, -1); break;
+      case '>': antc_emit(c, More, -1); break;
+      case ';': if (!antc_keep(c, 0)) antc_emit(c, Pop, -1); break;
+      case '#': antc_label(c); break;
+      case '@': antc_keep(c, 1), antc_jump(c, *c->lex.pc++ == 'b'); break;
+      default: break;
+    }
+    // clang-format on
+    if (strchr("=I;#@", *p) != NULL) stmt = 1;
+  }
+  antc_patch(c);       // Forward jumps without a label land here
+  if (c->depth > 1) {  // Leave only the bottom value
+    int depth = c->depth;
+    antc_emit(c, Pick, 1), antc_emit(c, depth, 0);
+    antc_emit(c, Nip, -depth), antc_emit(c, depth, 0);
+  }
+}
+
+// Compile postfix ant2 source `src` into ant3 bytecode, and add the source
+// position of every statement to `map`, if it is not NULL. A statement ends
+// with an assignment, an increment, a ';', a label or a jump. Return code
+// size, 0 on error or if the map does not fit into its buffer
+static inline size_t ant2_compile_map(const char *src, uint8_t *code,
+                                      size_t len, struct ant3 *vm,
+                                      struct ant3_map *map) {
+  return antc_run(src, code, len, vm, map, antc_postfix);
+}
+
+// Compile postfix ant2 source `src` into ant3 bytecode, with jump targets
+// resolved and literals stored into `vm->imm`. Return code size, 0 on error
+static inline size_t ant2_compile(const char *src, uint8_t *code, size_t len,
+                                  struct ant3 *vm) {
+  return ant2_compile_map(src, code, len, vm, NULL);
+}
+
+/////////////////////////////////////////////// ANT3 BYTECODE REWRITING
+// A rewrite rule looks at the instruction at code[i]. If it matches, the rule
+// writes a replacement into `out`, stores replacement size into `*n` and
+// returns the number of replaced source bytes. Otherwise, it returns 0.
+// Replacement must not be longer than the source. Jump targets in the
+// replacement are source offsets, set by ant3_set_target_at() as if `out`
+// was at offset `i` of `code`, so they stay in reach of short jumps. They
+// are relocated by ant3_rewrite(). `targets` is the jump target bitmap of
+// `code`, see ant3_targets()
+typedef size_t (*ant3_rule_t)(struct ant3 *, const uint8_t *code,
+                              const uint8_t *targets, size_t i, uint8_t *out,
+                              size_t *n);
+
+// Set a bit in the `targets` bitmap for every offset that a jump in `code`
+// lands on. Return code size including Done, or 0 if the code or a jump
+// target does not fit into `size` bits
+static inline size_t ant3_targets(const uint8_t *code, uint8_t *targets,
+                                  size_t size) {
+  size_t i;
+  memset(targets, 0, size / 8);
+  for (i = 0; i < size && code[i] != Done; i += ant3_oplen(&code[i])) {
+    long t = ant3_target(code, i);
+    if (t >= (long) size) return 0;
+    if (t >= 0) targets[t / 8] |= (uint8_t) (1U << (t % 8));
+  }
+  return i < size ? i + 1 : 0;
+}
+
+// Return true if a jump lands on offset `ofs`, according to `targets`
+static inline int ant3_is_target(const uint8_t *targets, size_t ofs) {
+  return (targets[ofs / 8] >> (ofs % 8)) & 1;
+}
+
+// Return true if a jump lands strictly between `lo` and `hi`
+static inline int ant3_jumps_into(const uint8_t *targets, size_t lo,
+                                  size_t hi) {
+  size_t i;
+  for (i = lo + 1; i < hi; i++) {
+    if (ant3_is_target(targets, i)) return 1;
+  }
+  return 0;
+}
+
+// Code offset that fits any offset below ANT3_CODE
+#if ANT3_CODE <= 256
+typedef uint8_t ant3_ofs_t;
+#else
+typedef uint16_t ant3_ofs_t;
+#endif
+
+// Apply rule to `code` and write result into `out`. Return size of the
+// result, or 0 if it does not fit into `len` bytes, or the code is longer
+// than ANT3_CODE. The first sweep maps source offsets to output offsets, the
+// second one writes the output and relocates jumps through the map
+static inline size_t ant3_rewrite(struct ant3 *vm, const uint8_t *code,
+                                  uint8_t *out, size_t len, ant3_rule_t rule) {
+  uint8_t buf[128], targets[ANT3_CODE / 8];
+  ant3_ofs_t map[ANT3_CODE];  // Output offset of every source offset
+  size_t i, k, m, n, used, size = ant3_targets(code, targets, ANT3_CODE);
+  if (size == 0) return 0;
+  for (i = n = 0; code[i] != Done; i += used, n += m) {
+    if ((used = rule(vm, code, targets, i, buf, &m)) == 0) {
+      m = used = ant3_oplen(&code[i]);
+    }
+    for (k = i; k < i + used && k < size; k++) map[k] = (ant3_ofs_t) n;
+  }
+  map[i] = (ant3_ofs_t) n;
+  for (i = n = 0; code[i] != Done; i += used, n += m) {
+    int copy = (used = rule(vm, code, targets, i, buf, &m)) == 0;
+    if (copy) memcpy(buf, &code[i], m = used = ant3_oplen(&code[i]));
+    if (n + m >= len) continue;
+    memcpy(&out[n], buf, m);
+    // Relocate jumps. Code never grows, so relocated targets stay in reach
+    for (k = 0; k < m; k += ant3_oplen(&buf[k])) {
+      long t = copy ? ant3_target(code, i) : ant3_target_at(&buf[k], i + k);
+      if (t < 0) continue;
+      if (t >= (long) size || !ant3_set_target(out, n + k, map[t])) return 0;
+    }
+  }
+  if (n >= len) return 0;
+  out[n] = Done;
+  return n + 1;
+}
+
+// Return index of the immediate with value `val`, or -1 if there is none
+static inline int ant3_find_imm(const struct ant3 *vm, antval_t val) {
+  int i;
+  for (i = 0; i < 10; i++) {
+    if (vm->imm[i] == val) return i;
+  }
+  return -1;
+}
+
+// Return a bit mask of immediate slots used by the code. Indices past the
+// imm[] table are ignored, ant3_verify() rejects them
+static inline unsigned ant3_used_imms(const uint8_t *code) {
+  const size_t nimm = sizeof(((struct ant3 *) 0)->imm) / sizeof(antval_t);
+  unsigned used = 0;
+  size_t i, k;
+  for (i = 0; code[i] != Done; i += ant3_oplen(&code[i])) {
+    const struct ant3_op *op = ant3_op(code[i]);
+    for (k = 0; op != NULL && op->args[k] != '\0'; k++) {
+      uint8_t idx = code[i + ant3_argofs(&code[i], k)];
+      if (op->args[k] == 'i' && idx < nimm) used |= 1U << idx;
+    }
+  }
+  return used;
+}
+
+// Store `val` into an immediate slot, unless some slot already holds it.
+// Slots set in the `*used` mask are not overwritten. Mark the slot as used
+static inline void ant3_alloc_imm(struct ant3 *vm, unsigned *used,
+                                  antval_t val) {
+  int slot = ant3_find_imm(vm, val);
+  if (slot < 0) {
+    slot = 0;
+    while (slot < 10 && (*used & (1U << slot))) slot++;
+    if (slot < 10) vm->imm[slot] = val;
+  }
+  if (slot < 10) *used |= 1U << slot;
+}
+
+// Superinstructions which do not involve AccumVar
+static inline size_t ant3_fuse2(const struct ant3 *vm, const uint8_t *code,
+                                const uint8_t *targets, size_t i, uint8_t *out,
+                                size_t *n) {
+  const uint8_t *p = &code[i];
+  size_t b = i, end;  // Offset after the 2nd push
+  antval_t val;
+  int imm = -1;
+  if (p[0] == PushVar) b = i + 2 + ant3_oplen(&p[2]);
+  if (p[0] == PushVar && ant3_push_const(vm, code, i + 2, &val)) {
+    imm = ant3_find_imm(vm, val);
+  }
+  if (p[0] == PushVar && (p[2] == PushVar || imm >= 0) && code[b] == Less &&
+      ant3_is_jump(code[b + 1]) &&
+      !ant3_jumps_into(targets, i, end = b + 1 + ant3_oplen(&code[b + 1]))) {
+    out[0] = p[2] == PushVar ? JumpVarLtVar : JumpVarLtImm;
+    out[1] = p[1], out[2] = p[2] == PushVar ? p[3] : (uint8_t) imm, *n = 5;
+    return ant3_set_target_at(out, i, (size_t) ant3_target(code, b + 1))
+               ? end - i
+               : 0;
+  } else if (p[0] == CmpVarImm && ant3_is_jump(p[3]) &&
+             !ant3_jumps_into(targets, i, end = i + 3 + ant3_oplen(&p[3]))) {
+    out[0] = JumpVarNeImm, out[1] = p[1], out[2] = p[2], *n = 5;
+    return ant3_set_target_at(out, i, (size_t) ant3_target(code, i + 3))
+               ? end - i
+               : 0;
+  } else if (p[0] == PushVar && p[2] == PushVar && p[4] == Plus &&
+             !ant3_jumps_into(targets, i, i + 5)) {
+    out[0] = AddVarVar, out[1] = p[1], out[2] = p[3], *n = 3;
+    return 5;
+  } else if (p[0] == PushVar && imm >= 0 && code[b] == Div &&
+             !ant3_jumps_into(targets, i, b + 1)) {
+    out[0] = DivVarImm, out[1] = p[1], out[2] = (uint8_t) imm, *n = 3;
+    return b + 1 - i;
+  }
+  return 0;
+}
+
+// Superinstruction rule. Turns "PushVar x, <expr>, Plus, PopVar x" into
+// "<expr>, AccumVar x", if <expr> is short and has no side effects
+static inline size_t ant3_fuse_rule(struct ant3 *vm, const uint8_t *code,
+                                    const uint8_t *targets, size_t i,
+                                    uint8_t *out, size_t *n) {
+  size_t j = i + 2, k, m = 0, used, len;
+  int depth = 0;
+  while (code[i] == PushVar && j < i + 34 && ant3_pure(code[j])) {
+    const struct ant3_op *op = ant3_op(code[j]);
+    if (code[j] == Plus && depth == 1 && code[j + 1] == PopVar &&
+        code[j + 2] == code[i + 1] && !ant3_jumps_into(targets, i, j + 3)) {
+      for (k = i + 2; k < j; k += used, m += len) {
+        used = ant3_fuse2(vm, code, targets, k, &out[m], &len);
+        if (used == 0 || k + used > j) {
+          memcpy(&out[m], &code[k], len = used = ant3_oplen(&code[k]));
+        }
+      }
+      out[m++] = AccumVar, out[m++] = code[i + 1], *n = m;
+      return j + 3 - i;
+    }
+    if (ant3_pops(&code[j]) > depth) break;
+    depth += op->push - ant3_pops(&code[j]);
+    j += ant3_oplen(&code[j]);
+  }
+  return ant3_fuse2(vm, code, targets, i, out, n);
+}
+
+// Replace common instruction sequences by superinstructions, to save on
+// dispatch. Inline constants compared with or divided by are stored into
+// immediate slots not used by the code. Write result into `out`, return its
+// size, or 0 on error
+static inline size_t ant3_fuse(struct ant3 *vm, const uint8_t *code,
+                               uint8_t *out, size_t len) {
+  unsigned used = ant3_used_imms(code);
+  size_t i, b;
+  antval_t val;
+  for (i = 0; code[i] != Done; i += ant3_oplen(&code[i])) {
+    if (code[i] != PushVar || !ant3_push_const(vm, code, i + 2, &val)) continue;
+    b = i + 2 + ant3_oplen(&code[i + 2]);
+    if (code[b] == Less || code[b] == Div) ant3_alloc_imm(vm, &used, val);
+  }
+  return ant3_rewrite(vm, code, out, len, ant3_fuse_rule);
+}
+
+// Evaluate a run of constant pushes and arithmetic instructions at code[i] that
+// leaves exactly one value on the stack. Store the value into `*val` and
+// return the size of the run, or 0 if there is no such run
+static inline size_t ant3_const(const struct ant3 *vm, const uint8_t *code,
+                                const uint8_t *targets, size_t i,
+                                antval_t *val) {
+  antval_t stk[10];
+  size_t j, size = 0;
+  int n = 0;
+  for (j = i; code[j] != Done; j += ant3_oplen(&code[j])) {
+    unsigned long a, b;
+    if (j > i && ant3_is_target(targets, j)) break;
+    if (ant3_push_const(vm, code, j, &stk[n < 10 ? n : 9])) {
+      if (n++ >= 10) break;
+    } else if (n >= 2) {
+      a = (unsigned long) stk[n - 2], b = (unsigned long) stk[n - 1];
+      switch (code[j]) {
+        // clang-format off
+        case Plus:  a += b; break;
+        case Minus: a -= b; break;
+        case Mul:   a *= b; break;
+        case Equal: a = stk[n - 2] == stk[n - 1]; break;
+        case Less:  a = stk[n - 2] < stk[n - 1]; break;
+        case More:  a = stk[n - 2] > stk[n - 1]; break;
+        case Div:
+          if (stk[n - 1] == 0 || stk[n - 1] == -1) return size;
+          a = (unsigned long) (stk[n - 2] / stk[n - 1]);
+          break;
+        default: return size;
+        // clang-format on
+      }
+      stk[--n - 1] = (antval_t) a;
+    } else {
+      break;
+    }
+    if (n == 1) size = j + ant3_oplen(&code[j]) - i, *val = stk[0];
+  }
+  return size;
+}
+
+// Store values of foldable constant runs that are too big to be inlined into
+// immediate slots not used by the code, so that ant3_opt_rule() can use them
+static inline void ant3_alloc_consts(struct ant3 *vm, const uint8_t *code) {
+  unsigned used = ant3_used_imms(code);
+  size_t i;
+  antval_t val;
+  uint8_t buf[9], targets[ANT3_CODE / 8];
+  if (ant3_targets(code, targets, ANT3_CODE) == 0) return;
+  for (i = 0; code[i] != Done; i += ant3_oplen(&code[i])) {
+    size_t m = ant3_const(vm, code, targets, i, &val);
+    if (m > 0 && ant3_pushi(buf, val) > m) ant3_alloc_imm(vm, &used, val);
+  }
+}
+
+// Return true if variable `v` is overwritten after the instruction at code[i]
+// and before it is read, within the same basic block
+static inline int ant3_dead_store(const uint8_t *code, const uint8_t *targets,
+                                  size_t i, uint8_t v) {
+  size_t j, k;
+  for (j = i + ant3_oplen(&code[i]); code[j] != Done;
+       j += ant3_oplen(&code[j])) {
+    const struct ant3_op *op = ant3_op(code[j]);
+    const char *args = op == NULL ? "t" : op->args;
+    if (ant3_is_target(targets, j) || code[j] == Ret) return 0;
+    if ((code[j] == PopVar || code[j] == Assign) && code[j + 1] == v) return 1;
+    if (strpbrk(args, "trR") != NULL) return 0;
+    for (k = 0; args[k] != '\0'; k++) {
+      if ((args[k] == 'v' || args[k] == 'V') &&
+          code[j + ant3_argofs(&code[j], k)] == v) {
+        return 0;
+      }
+    }
+  }
+  return 0;
+}
+
+// Follow the jump target `t` through unconditional jumps "PushImm x, Jump",
+// x != 0, and through identical conditional jumps. Return the final target
+static inline size_t ant3_thread(const struct ant3 *vm, const uint8_t *code,
+                                 const uint8_t *targets, size_t i, size_t t) {
+  int hops;
+  for (hops = 0; hops < 8; hops++) {
+    antval_t val = 0;
+    size_t n = ant3_const(vm, code, targets, t, &val);
+    if (n > 0 && val != 0 && ant3_is_jump(code[t + n]) &&
+        !ant3_is_target(targets, t + n)) {
+      t = (size_t) ant3_target(code, t + n);
+    } else if (!ant3_is_jump(code[i]) && code[t] == code[i] &&
+               code[t + 1] == code[i + 1] && code[t + 2] == code[i + 2]) {
+      t = (size_t) ant3_target(code, t);
+    } else {
+      break;
+    }
+  }
+  return t;
+}
+
+// Write a push of `val` into `out`, inline or from the imm[] pool, whichever
+// is shorter. Return its size
+static inline size_t ant3_push(const struct ant3 *vm, uint8_t *out,
+                               antval_t val) {
+  int slot = ant3_find_imm(vm, val);
+  size_t n = ant3_pushi(out, val);
+  if (slot >= 0 && n > 2) out[0] = PushImm, out[1] = (uint8_t) slot, n = 2;
+  return n;
+}
+
+// Peephole optimizer rule, see ant3_optimize()
+static inline size_t ant3_opt_rule(struct ant3 *vm, const uint8_t *code,
+                                   const uint8_t *targets, size_t i,
+                                   uint8_t *out, size_t *n) {
+  const struct ant3_op *op = ant3_op(code[i]);
+  size_t len = op == NULL ? 1 : ant3_oplen(&code[i]);
+  antval_t val = 0;
+  size_t m = ant3_const(vm, code, targets, i, &val);
+  size_t k = m > len ? ant3_push(vm, out, val) : 0;  // Folded constant size
+  *n = 0;
+  if (op == NULL) return 0;
+  if (m > 0 && ant3_is_jump(code[i + m]) && !ant3_is_target(targets, i + m)) {
+    size_t jlen = ant3_oplen(&code[i + m]);
+    if (val == 0) return m + jlen;  // Jump is never taken, remove it
+    if (k > 0 && k <= m) {
+      memcpy(&out[k], &code[i + m], jlen);
+      *n = k + jlen;
+      return ant3_set_target_at(&out[k], i + k,
+                                (size_t) ant3_target(code, i + m))
+                 ? m + jlen
+                 : 0;
+    }
+  }
+  if (m > 0 && code[i + m] == Pop && !ant3_is_target(targets, i + m)) {
+    return m + 1;
+  }
+  if (k > 0 && k <= m) {
+    *n = k;
+    return m;
+  }
+  if (code[i + len] == Pop && !ant3_is_target(targets, i + len) &&
+      ant3_pure(code[i]) && op->pop == 0 && op->push == 1) {
+    return len + 1;  // Push followed by Pop
+  }
+  if (code[i + len] == Pop && !ant3_is_target(targets, i + len) &&
+      code[i] != Div && ant3_pure(code[i]) && op->pop == 2 && op->push == 1) {
+    out[0] = out[1] = Pop, *n = 2;  // Result is discarded, drop the operands
+    return 2;
+  }
+  if (code[i] == PushImm && code[i + 2] == PopVar &&
+      !ant3_is_target(targets, i + 2)) {
+    out[0] = Assign, out[1] = code[i + 3], out[2] = code[i + 1], *n = 3;
+    return 4;
+  }
+  if (code[i] == PopVar && ant3_dead_store(code, targets, i, code[i + 1])) {
+    out[0] = Pop, *n = 1;
+    return 2;
+  }
+  if (code[i] == Assign && ant3_dead_store(code, targets, i, code[i + 1])) {
+    return 3;
+  }
+  if (ant3_target(code, i) >= 0 && code[i] != Call && code[i] != Func) {
+    size_t t =
+        ant3_thread(vm, code, targets, i, (size_t) ant3_target(code, i));
+    if (t == i + len) {
+      if (ant3_is_jump(code[i])) out[0] = Pop, *n = 1;  // Jump to next insn
+      return len;
+    }
+    if (t != (size_t) ant3_target(code, i)) {
+      memcpy(out, &code[i], *n = len);
+      return ant3_set_target_at(out, i, t) ? len : 0;
+    }
+  }
+  return 0;
+}
+
+// Optimize bytecode: fold constant expressions, thread jumps, remove dead
+// stores and values that are pushed only to be popped. Assumes that the
+// program leaves its result on the stack. Immediate slots not used by the
+// code may be overwritten with folded constants. Write result into `out`,
+// return its size, or 0 on error. Passes are repeated until the code stops
+// changing, at most 16 times. If `removed` is not NULL, store the number of
+// removed instructions there
+static inline size_t ant3_optimize(struct ant3 *vm, const uint8_t *code,
+                                   uint8_t *out, size_t len, size_t *removed) {
+  uint8_t prev[ANT3_CODE];  // Input of the next pass
+  size_t i, n, m, passes, count = 0;
+  for (i = 0; code[i] != Done; i += ant3_oplen(&code[i])) count++;
+  ant3_alloc_consts(vm, code);
+  n = ant3_rewrite(vm, code, out, len, ant3_opt_rule);
+  for (passes = 0; n > 0 && passes < 16; passes++) {
+    memcpy(prev, out, n);
+    ant3_alloc_consts(vm, prev);
+    m = ant3_rewrite(vm, prev, out, len, ant3_opt_rule);
+    if (m == 0) memcpy(out, prev, n);  // Keep the result of the last pass
+    if (m == 0 || (m == n && memcmp(out, prev, n) == 0)) break;
+    n = m;
+  }
+  for (i = 0; n > 0 && out[i] != Done; i += ant3_oplen(&out[i])) count--;
+  if (removed != NULL) *removed = n > 0 ? count : 0;
+  return n;
+}
+
+// Division by a constant rule, see ant3_divconst()
+static inline size_t ant3_div_rule(struct ant3 *vm, const uint8_t *code,
+                                   const uint8_t *targets, size_t i,
+                                   uint8_t *out, size_t *n) {
+  size_t len = ant3_oplen(&code[i]);
+  antval_t d, m;
+  uint8_t flags;
+  int slot;
+  if (!ant3_push_const(vm, code, i, &d) || code[i + len] != Div ||
+      ant3_is_target(targets, i + len) || !ant3_magic(d, &m, &flags) ||
+      (slot = ant3_find_imm(vm, m)) < 0) {
+    return 0;
+  }
+  out[0] = DivMagic, out[1] = (uint8_t) slot, out[2] = flags, *n = 3;
+  return len + 1;
+}
+
+// Replace division by a constant, e.g. "PushImm d, Div", by DivMagic that does
+// a multiplication by a precomputed magic number. Magic numbers are stored
+// into immediate slots not used by the code. Write result into `out`,
+// return its size, or 0 on error
+static inline size_t ant3_divconst(struct ant3 *vm, const uint8_t *code,
+                                   uint8_t *out, size_t len) {
+  unsigned used = ant3_used_imms(code);
+  uint8_t flags;
+  antval_t d, m;
+  size_t i;
+  for (i = 0; code[i] != Done; i += ant3_oplen(&code[i])) {
+    if (ant3_push_const(vm, code, i, &d) &&
+        code[i + ant3_oplen(&code[i])] == Div && ant3_magic(d, &m, &flags)) {
+      ant3_alloc_imm(vm, &used, m);
+    }
+  }
+  return ant3_rewrite(vm, code, out, len, ant3_div_rule);
+}
+
+/////////////////////////////////////////////// ANT3 JIT
+// Template JIT for x86-64 Linux: each ant3 instruction is translated into a
+// fixed machine code sequence. RDI holds the ant3 pointer, so variables and
+// immediates are addressed directly by displacement. R8 holds stack pointer.
+// Within a basic block the top of the stack stays in RAX, and the most used
+// variables live in callee-saved registers while the program runs.
+// On other platforms, ant3_jit() returns NULL: use ant3_eval2() instead
+typedef antval_t (*ant3_jit_t)(struct ant3 *);
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(ANT_NO_JIT)
+#include <sys/mman.h>
+#ifdef MAP_ANONYMOUS  // glibc hides it in strict ISO C modes
+#define ANT3_JIT
+#endif
+#endif
+
+#ifdef ANT3_JIT
+#define ANT3J_REGS 5  // Callee-saved registers for variables: rbx, r12-r15
+
+struct ant3j {
+  uint8_t *buf;              // Output buffer, or NULL when measuring code size
+  size_t n;                  // Number of bytes emitted
+  uint32_t *at;              // Machine code offset of each bytecode offset
+  int tos;                   // Top of the stack is in RAX, not in memory
+  int nregs;                 // Number of variables kept in registers
+  uint8_t vars[ANT3J_REGS];  // Variable kept in each register
+  uint8_t regs[256];         // Register of each variable, 0 if in memory
+};
+
+#define ANT3J_VAR(i) (offsetof(struct ant3, vars) + (i) * sizeof(antval_t))
+#define ANT3J_IMM(i) (offsetof(struct ant3, imm) + (i) * sizeof(antval_t))
+#define ANT3J_STK offsetof(struct ant3, stack)
+
+static inline void ant3j_emit(struct ant3j *j, const char *bytes, size_t n) {
+  if (j->buf != NULL) memcpy(&j->buf[j->n], bytes, n);
+  j->n += n;
+}
+
+static inline void ant3j_byte(struct ant3j *j, int byte) {
+  char c = (char) byte;
+  ant3j_emit(j, &c, 1);
+}
+
+static inline void ant3j_d32(struct ant3j *j, long v) {
+  char d[4];
+  d[0] = (char) v, d[1] = (char) (v >> 8);
+  d[2] = (char) (v >> 16), d[3] = (char) (v >> 24);
+  ant3j_emit(j, d, sizeof(d));
+}
+
+// Emit instruction `op` with the [rdi + disp32] memory operand
+static inline void ant3j_mem(struct ant3j *j, const char *op, int reg,
+                             size_t disp) {
+  char modrm = (char) (0x87 | (reg << 3));
+  ant3j_emit(j, op, 2);
+  ant3j_emit(j, &modrm, 1);
+  ant3j_d32(j, (long) disp);
+}
+
+// Emit instruction `op` with variable `v` as the r/m operand: its register,
+// or its slot in memory
+static inline void ant3j_var(struct ant3j *j, const char *op, int reg,
+                             uint8_t v) {
+  int r = j->regs[v];
+  if (r == 0) {
+    ant3j_mem(j, op, reg, ANT3J_VAR(v));
+  } else {
+    ant3j_byte(j, op[0] | (r >> 3));  // REX.B selects r12-r15
+    ant3j_byte(j, op[1]);
+    ant3j_byte(j, 0xc0 | (reg << 3) | (r & 7));
+  }
+}
+
+// Load variable kept in register `r` from memory, or store it back
+static inline void ant3j_spill(struct ant3j *j, int r, uint8_t v, int store) {
+  ant3j_byte(j, 0x48 | (r >> 3 << 2));  // REX.R selects r12-r15
+  ant3j_byte(j, store ? 0x89 : 0x8b);
+  ant3j_byte(j, 0x87 | ((r & 7) << 3));
+  ant3j_d32(j, (long) ANT3J_VAR(v));
+}
+
+static inline int ant3j_reg(int k) {
+  static const uint8_t regs[ANT3J_REGS] = {3, 12, 13, 14, 15};
+  return regs[k];
+}
+
+#define ANT3J_PUSH "\x49\x89\x00\x49\x83\xc0\x08"  // mov [r8],rax; add r8,8
+#define ANT3J_POP "\x49\x83\xe8\x08\x49\x8b\x00"   // sub r8,8; mov rax,[r8]
+#define ANT3J_SWAP "\x48\x89\xc1" ANT3J_POP  // rcx = top, rax = next value
+
+// Write the top of the stack from RAX to memory
+static inline void ant3j_flush(struct ant3j *j) {
+  if (j->tos) ant3j_emit(j, ANT3J_PUSH, 7);
+  j->tos = 0;
+}
+
+// Take the top of the stack into RAX
+static inline void ant3j_pop(struct ant3j *j) {
+  if (!j->tos) ant3j_emit(j, ANT3J_POP, 7);
+  j->tos = 0;
+}
+
+// Emit jump or call opcode and rel32 to the target of the jump at code[i]
+static inline void ant3j_jcc(struct ant3j *j, const char *op,
+                             const uint8_t *code, size_t i) {
+  long t = ant3_target(code, i);
+  ant3j_emit(j, op, strlen(op));
+  ant3j_d32(j, j->buf == NULL ? 0 : (long) j->at[t] - (long) j->n - 4);
+}
+
+// Keep the most used variables in registers
+static inline void ant3j_alloc(struct ant3j *j, const uint8_t *code) {
+  unsigned long uses[256];
+  size_t i, k, best;
+  memset(uses, 0, sizeof(uses));
+  for (i = 0; code[i] != Done; i += ant3_oplen(&code[i])) {
+    const struct ant3_op *op = ant3_op(code[i]);
+    for (k = 0; op != NULL && op->args[k] != '\0'; k++) {
+      if (op->args[k] == 'v' || op->args[k] == 'V') {
+        uses[code[i + ant3_argofs(&code[i], k)]]++;
+      }
+    }
+  }
+  for (j->nregs = 0; j->nregs < ANT3J_REGS; j->nregs++) {
+    for (best = i = 0; i < 256; i++) {
+      if (uses[i] > uses[best]) best = i;
+    }
+    if (uses[best] == 0) break;
+    j->vars[j->nregs] = (uint8_t) best, uses[best] = 0;
+    j->regs[best] = (uint8_t) ant3j_reg(j->nregs);
+  }
+}
+
+// Emit machine code for the instruction at code[i]. Return 0 if the
+// instruction is not supported
+static inline int ant3j_insn(struct ant3j *j, const uint8_t *code, size_t i) {
+  const uint8_t *p = &code[i];
+  int k;
+  switch (p[0]) {
+    case Done:
+      ant3j_flush(j);
+      ant3j_mem(j, "\x48\x8d", 1, ANT3J_STK);  // lea rcx,[stack]
+      ant3j_emit(j, "\x49\x29\xc8\x49\xc1\xe8\x03", 7);  // r8=(r8-rcx)/8
+      ant3j_mem(j, "\x44\x89", 0, offsetof(struct ant3, sp));
+      ant3j_mem(j, "\x48\x8b", 0, ANT3J_STK);  // mov rax,[stack]
+      ant3j_emit(j, "\x4d\x85\xc0\x49\x0f\x44\xc0", 7);  // 0 if empty
+      for (k = j->nregs - 1; k >= 0; k--) {     // Store variables, pop regs
+        ant3j_spill(j, ant3j_reg(k), j->vars[k], 1);
+        if (ant3j_reg(k) >= 8) ant3j_byte(j, 0x41);
+        ant3j_byte(j, 0x58 | (ant3j_reg(k) & 7));
+      }
+      ant3j_emit(j, "\xc3", 1);  // ret
+      break;
+    case IncVar:
+      ant3j_var(j, "\x48\xff", 0, p[1]);  // inc var
+      break;
+    case Assign:
+      ant3j_mem(j, "\x48\x8b", 1, ANT3J_IMM(p[2]));  // mov rcx,[imm]
+      ant3j_var(j, "\x48\x89", 1, p[1]);
+      break;
+    case PushVar:
+      ant3j_flush(j);
+      ant3j_var(j, "\x48\x8b", 0, p[1]);
+      j->tos = 1;
+      break;
+    case PopVar:
+      ant3j_pop(j);
+      ant3j_var(j, "\x48\x89", 0, p[1]);
+      break;
+    case PushImm:
+      ant3j_flush(j);
+      ant3j_mem(j, "\x48\x8b", 0, ANT3J_IMM(p[1]));
+      j->tos = 1;
+      break;
+    case Pop:
+      if (!j->tos) ant3j_emit(j, "\x49\x83\xe8\x08", 4);  // sub r8,8
+      j->tos = 0;
+      break;
+    case Plus:
+      ant3j_pop(j);
+      ant3j_emit(j, "\x49\x83\xe8\x08\x49\x03\x00", 7);  // add rax,[r8]
+      j->tos = 1;
+      break;
+    case Minus:
+      ant3j_pop(j);
+      ant3j_emit(j, ANT3J_SWAP "\x48\x29\xc8", 13);  // sub rax,rcx
+      j->tos = 1;
+      break;
+    case Mul:
+      ant3j_pop(j);
+      ant3j_emit(j, "\x49\x83\xe8\x08\x49\x0f\xaf\x00", 8);  // imul rax,[r8]
+      j->tos = 1;
+      break;
+    case Div:
+      ant3j_pop(j);
+      ant3j_emit(j, ANT3J_SWAP "\x48\x99\x48\xf7\xf9", 15);  // idiv rcx
+      j->tos = 1;
+      break;
+    case Equal:  // cmp rax,rcx; setcc al; movzx eax,al
+    case Less:
+    case More:
+      ant3j_pop(j);
+      ant3j_emit(j, ANT3J_SWAP "\x48\x39\xc8\x0f", 14);
+      ant3j_byte(j, p[0] == Equal ? 0x94 : p[0] == Less ? 0x9c : 0x9f);
+      ant3j_emit(j, "\xc0\x0f\xb6\xc0", 4);
+      j->tos = 1;
+      break;
+    case CmpVarImm:
+      ant3j_flush(j);
+      ant3j_var(j, "\x48\x8b", 0, p[1]);
+      ant3j_mem(j, "\x48\x2b", 0, ANT3J_IMM(p[2]));  // sub rax,[imm]
+      j->tos = 1;
+      break;
+    case Jump:
+    case JumpS:
+    case JumpL:
+      if (j->tos) {
+        ant3j_emit(j, "\x48\x85\xc0", 3);  // test rax,rax
+      } else {  // sub r8,8; cmp qword [r8],0
+        ant3j_emit(j, "\x49\x83\xe8\x08\x49\x83\x38\x00", 8);
+      }
+      j->tos = 0;
+      ant3j_jcc(j, "\x0f\x85", code, i);  // jne
+      break;
+    case AddVarVar:
+      ant3j_flush(j);
+      ant3j_var(j, "\x48\x8b", 0, p[1]);
+      ant3j_var(j, "\x48\x03", 0, p[2]);  // add rax,var
+      j->tos = 1;
+      break;
+    case DivVarImm:
+      ant3j_flush(j);
+      ant3j_var(j, "\x48\x8b", 0, p[1]);
+      ant3j_emit(j, "\x48\x99", 2);                  // cqo
+      ant3j_mem(j, "\x48\xf7", 7, ANT3J_IMM(p[2]));  // idiv qword [imm]
+      j->tos = 1;
+      break;
+    case DivMagic: {  // rdx:rax = magic * top, result is derived from rdx
+      char shift = (char) (p[2] & 0x3f);
+      ant3j_pop(j);
+      ant3j_emit(j, "\x48\x89\xc1", 3);  // mov rcx,rax
+      ant3j_mem(j, "\x48\x8b", 0, ANT3J_IMM(p[1]));
+      ant3j_emit(j, "\x48\xf7\xe9", 3);                   // imul rcx
+      if (p[2] & 0x40) ant3j_emit(j, "\x48\x01\xca", 3);  // add rdx,rcx
+      if (p[2] & 0x80) ant3j_emit(j, "\x48\x29\xca", 3);  // sub rdx,rcx
+      ant3j_emit(j, "\x48\xc1\xfa", 3);                   // sar rdx,shift
+      ant3j_emit(j, &shift, 1);
+      ant3j_emit(j, "\x48\x89\xd0\x48\xc1\xe8\x3f", 7);  // rax=rdx>>63 (u)
+      ant3j_emit(j, "\x48\x01\xd0", 3);                  // rax+=rdx
+      j->tos = 1;
+      break;
+    }
+    case PushI8:
+    case PushI16:
+    case PushI32:
+    case PushI64: {
+      antval_t v = ant3_int(&p[1], ant3_oplen(p) - 1);
+      ant3j_flush(j);
+      if (v >= -2147483647L - 1 && v <= 2147483647L) {
+        ant3j_emit(j, "\x48\xc7\xc0", 3);  // mov rax,imm32
+        ant3j_d32(j, v);
+      } else {
+        ant3j_emit(j, "\x48\xb8", 2);  // mov rax,imm64
+        ant3j_d32(j, v), ant3j_d32(j, v >> 32);
+      }
+      j->tos = 1;
+      break;
+    }
+    case CallNative: {
+      // ant3_call(&ant->fns[fn], r8 - nargs * 8, nargs), rdi and r8 saved.
+      // The native stack is realigned, since it may hold return addresses
+      antval_t (*fn)(const struct ant3_fn *, const antval_t *, int) = ant3_call;
+      unsigned long addr;
+      char disp = (char) (p[2] * sizeof(antval_t));
+      memcpy(&addr, &fn, sizeof(addr));
+      ant3j_flush(j);
+      ant3j_emit(j, "\x49\x83\xe8", 3);  // sub r8,nargs*8
+      ant3j_emit(j, &disp, 1);
+      ant3j_mem(j, "\x48\x8b", 0, offsetof(struct ant3, fns));  // mov rax,[fns]
+      ant3j_emit(j, "\x57\x41\x50\x55\x48\x89\xe5", 7);  // push; rbp=rsp
+      ant3j_emit(j, "\x48\x83\xe4\xf0", 4);  // and rsp,-16
+      ant3j_emit(j, "\x48\x8d\xb8", 3);  // lea rdi,[rax+fn*size]
+      ant3j_d32(j, (long) (p[1] * sizeof(struct ant3_fn)));
+      ant3j_emit(j, "\x4c\x89\xc6\xba", 4);  // mov rsi,r8; mov edx,nargs
+      ant3j_d32(j, p[2]);
+      ant3j_emit(j, "\x49\xbb", 2);  // mov r11,ant3_call
+      ant3j_d32(j, (long) addr), ant3j_d32(j, (long) (addr >> 32));
+      ant3j_emit(j, "\x41\xff\xd3", 3);  // call r11
+      ant3j_emit(j, "\x48\x89\xec\x5d\x41\x58\x5f", 7);  // restore
+      j->tos = 1;
+      break;
+    }
+    case Func:
+      ant3j_flush(j);
+      ant3j_jcc(j, "\xe9", code, i);  // jmp
+      break;
+    case Call:  // Functions are called with the native call instruction
+      ant3j_flush(j);
+      ant3j_jcc(j, "\xe8", code, i);  // call
+      break;
+    case Ret:
+    case Nip: {
+      char disp = (char) (p[1] * sizeof(antval_t));
+      ant3j_pop(j);
+      ant3j_emit(j, "\x49\x83\xe8", 3);  // sub r8,count*8
+      ant3j_emit(j, &disp, 1);
+      j->tos = 1;
+      if (p[0] == Ret) ant3j_flush(j), ant3j_emit(j, "\xc3", 1);  // ret
+      break;
+    }
+    case Pick: {
+      char disp = (char) (-(int) p[1] * (int) sizeof(antval_t));
+      ant3j_flush(j);
+      ant3j_emit(j, "\x49\x8b\x40", 3);  // mov rax,[r8-depth*8]
+      ant3j_emit(j, &disp, 1);
+      j->tos = 1;
+      break;
+    }
+    case AccumVar:
+      ant3j_pop(j);
+      ant3j_var(j, "\x48\x01", 0, p[1]);  // add var,rax
+      break;
+    case JumpVarLtVar:
+    case JumpVarLtImm:
+    case JumpVarNeImm:
+      ant3j_flush(j);
+      ant3j_var(j, "\x48\x8b", 0, p[1]);
+      if (p[0] == JumpVarLtVar) {
+        ant3j_var(j, "\x48\x3b", 0, p[2]);  // cmp rax,var
+      } else {
+        ant3j_mem(j, "\x48\x3b", 0, ANT3J_IMM(p[2]));  // cmp rax,[imm]
+      }
+      ant3j_jcc(j, p[0] == JumpVarNeImm ? "\x0f\x85" : "\x0f\x8c", code, i);
+      break;
+    default:
+      return 0;
+  }
+  return 1;
+}
+
+// Emit the whole program: save registers and load variables into them, then
+// translate instructions. The top of the stack is written to memory before
+// jump targets, so that every basic block starts with it in memory. Record
+// machine code offset of every instruction. Return 0 on error
+static inline int ant3j_prog(struct ant3j *j, const uint8_t *code,
+                             const uint8_t *targets) {
+  size_t i;
+  int k;
+  for (k = 0; k < j->nregs; k++) {
+    if (ant3j_reg(k) >= 8) ant3j_byte(j, 0x41);
+    ant3j_byte(j, 0x50 | (ant3j_reg(k) & 7));  // push reg
+    ant3j_spill(j, ant3j_reg(k), j->vars[k], 0);
+  }
+  ant3j_mem(j, "\x4c\x8d", 0, ANT3J_STK);  // lea r8,[stack]
+  j->tos = 0;
+  for (i = 0;; i += ant3_oplen(&code[i])) {
+    if (ant3_is_target(targets, i)) ant3j_flush(j);
+    j->at[i] = (uint32_t) j->n;
+    if (!ant3j_insn(j, code, i)) return 0;
+    if (code[i] == Done) return 1;
+  }
+}
+
+// Translate ant3 bytecode into machine code. Return a function that executes
+// the program, or NULL on error. Release it with ant3_jit_free(). The first
+// pass measures code size and instruction offsets, the second one emits the
+// code with jumps resolved through the offsets. The offset table is mapped
+// for the actual code size. Code longer than ANT3_CODE is not supported
+static inline ant3_jit_t ant3_jit(const uint8_t *code) {
+  struct ant3j j;
+  uint8_t targets[ANT3_CODE / 8];
+  size_t i, size, len = ant3_targets(code, targets, ANT3_CODE), hdr = 16;
+  ant3_jit_t fn = NULL;
+  uint8_t *mem;
+  if (len == 0) return NULL;
+  for (i = 0; code[i] != Done; i += ant3_oplen(&code[i])) {
+    if (ant3_target(code, i) >= (long) len) return NULL;
+  }
+  memset(&j, 0, sizeof(j));
+  j.at = (uint32_t *) mmap(NULL, len * sizeof(*j.at), PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if ((void *) j.at == MAP_FAILED) return NULL;
+  ant3j_alloc(&j, code);
+  if (ant3j_prog(&j, code, targets)) {
+    size = hdr + j.n;
+    mem = (uint8_t *) mmap(NULL, size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED) {
+      memcpy(mem, &size, sizeof(size));
+      j.buf = mem + hdr, j.n = 0;
+      ant3j_prog(&j, code, targets);
+      if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, size);
+      } else {
+        mem += hdr;
+        memcpy(&fn, &mem, sizeof(fn));
+      }
+    }
+  }
+  munmap(j.at, len * sizeof(*j.at));
+  return fn;
+}
+
+static inline void ant3_jit_free(ant3_jit_t fn) {
+  uint8_t *mem;
+  size_t size;
+  if (fn == NULL) return;
+  memcpy(&mem, &fn, sizeof(mem));
+  mem -= 16;
+  memcpy(&size, mem, sizeof(size));
+  munmap(mem, size);
+}
+#else
+static inline ant3_jit_t ant3_jit(const uint8_t *code) {
+  (void) code;
+  return NULL;
+}
+
+static inline void ant3_jit_free(ant3_jit_t fn) {
+  (void) fn;
+}
+#endif
+
+/////////////////////////////////////////////// ANT 4
+// Single buffer engine. ant4_compile() translates infix ant source into
+// compact bytecode, ant4_exec() runs it. Everything lives in the memory block
+// given to ant4_create(), laid out as follows:
+//
+//   [struct ant4][code ->     <- stack][<- symbol table]
+//
+// Symbol table entries hold variables and deduplicated literals. Each entry
+// is a value followed by the name length and the name, padded to antval_t
+// alignment; literals have no name. Code refers to an entry by its slot: the
+// distance of its value from the buffer end, in antval_t units. Variables
+// keep their values between compilations, literals are dropped when a new
+// compilation starts
+struct ant4 {
+  const char *s;           // Source code. Required by compiler
+  const char *eof;         // End of source code
+  antval_t val;            // Parsed value. Required by compiler
+  int tok;                 // Parsed token
+  const char *id;          // Parsed identifier
+  size_t idlen;            // Parsed identifier length
+  const char *err;         // Error message, or NULL
+  int depth, maxdepth;     // Current and maximum stack depth
+  int pending;             // Expression value is left on stack
+  size_t label;            // Code offset of the last label
+  size_t fwd;              // 1 + offset of the last unpatched forward jump
+  uint8_t *ssym, *esym;    // Symbol table, grows down from the buffer end
+  uint8_t *scode, *ecode;  // Code, grows up from the end of this struct
+};
+
+// clang-format off
+enum {
+  AEOF,    //                 Stop, return stack top
+  APUSH,   // slot            Push slot value
+  ASTORE,  // slot            Store stack top into slot
+  ADROP,   //                 Pop value
+  APLUS, AMINUS, AMUL, ADIV, AEQ, ALT, AGT,  // Pop 2 values, push result
+  AJUMP,   // rel16           Pop value, jump if it is non zero
+};
+// clang-format on
+enum { TINV = Inv, TEOF = Eof, TNUM = Num, TVAR = Var };  // ant_lex() tokens
+enum { TEQ = Eq, TINC = Inc, TDEC = Dec };
+
+static inline size_t ant_roundup(size_t size, size_t align) {
+  return (size + align - 1) / align * align;
+}
+
+static inline void ant4_err(struct ant4 *ant, const char *msg) {
+  if (ant->err == NULL) ant->err = msg;
+  ant->s = ant->eof;
+  ant->tok = TEOF;
+}
+
+static inline int ant4_next(struct ant4 *ant) {
+  if (ant->tok != TINV) return ant->tok;
+  ant->tok = ant_lex(&ant->s, ant->eof, ANT_CSTART, &ant->val);
+  if (ant->tok == TVAR) {
+    ant->id = ant->s - 1;
+    ant->s = ant_skip_ident(ant->s, ant->eof);
+    ant->idlen = (size_t) (ant->s - ant->id);
+  }
+  return ant->tok;
+}
+
+static inline int ant4_isnext(struct ant4 *ant, int tok) {
+  if (ant4_next(ant) != tok) return 0;
+  ant->tok = TINV;
+  return 1;
+}
+
+static inline void ant4_emit(struct ant4 *ant, int byte, int stack_effect) {
+  if (ant->ecode >= ant->ssym) {
+    ant4_err(ant, "out of memory");
+  } else {
+    *ant->ecode++ = (uint8_t) byte;
+  }
+  ant->depth += stack_effect;
+  if (ant->depth > ant->maxdepth) ant->maxdepth = ant->depth;
+}
+
+static inline void ant4_emit2(struct ant4 *ant, int op, int slot) {
+  ant4_emit(ant, op, op == APUSH ? 1 : 0);
+  ant4_emit(ant, slot, 0);
+}
+
+// Return slot of the variable `name`, or of the literal `val` if `len` is 0.
+// Add the entry if it does not exist. Return 0 if there is no room
+static inline int ant4_slot(struct ant4 *ant, const char *name, size_t len,
+                            antval_t val) {
+  size_t size = ant_roundup(sizeof(val) + 1 + len, sizeof(val));
+  antval_t v;
+  uint8_t *p;
+  for (p = ant->ssym; p < ant->esym;
+       p += ant_roundup(sizeof(v) + 1 + p[sizeof(v)], sizeof(v))) {
+    memcpy(&v, p, sizeof(v));
+    if (p[sizeof(v)] == len &&
+        (len > 0 ? memcmp(&p[sizeof(v) + 1], name, len) == 0 : v == val)) {
+      return (int) ((size_t) (ant->esym - p) / sizeof(v));
+    }
+  }
+  if (len > 255 || (size_t) (ant->ssym - ant->ecode) < size ||
+      (size_t) (ant->esym - ant->ssym) + size > 255 * sizeof(val)) {
+    ant4_err(ant, "out of memory");
+    return 0;
+  }
+  p = ant->ssym -= size;
+  memcpy(p, &val, sizeof(val));
+  p[sizeof(val)] = (uint8_t) len;
+  if (len > 0) memcpy(&p[sizeof(val) + 1], name, len);
+  return (int) ((size_t) (ant->esym - p) / sizeof(val));
+}
+
+// Remove literals from the symbol table, moving variables up over them
+static inline void ant4_drop_literals(struct ant4 *ant) {
+  uint8_t *p = ant->ssym;
+  while (p < ant->esym) {
+    size_t size = ant_roundup(sizeof(antval_t) + 1 + p[sizeof(antval_t)],
+                              sizeof(antval_t));
+    if (p[sizeof(antval_t)] == 0) {
+      memmove(ant->ssym + size, ant->ssym, (size_t) (p - ant->ssym));
+      ant->ssym += size;
+    }
+    p += size;
+  }
+}
+
+static void ant4_expr(struct ant4 *ant);
+static inline void ant4_primary(struct ant4 *ant) {
+  int tok = ant4_next(ant);
+  ant->tok = TINV;
+  if (tok == '(') {
+    ant4_expr(ant);
+    if (!ant4_isnext(ant, ')')) ant4_err(ant, "parse error");
+  } else if (tok == TNUM) {
+    ant4_emit2(ant, APUSH, ant4_slot(ant, NULL, 0, ant->val));
+  } else if (tok == TVAR) {
+    ant4_emit2(ant, APUSH, ant4_slot(ant, ant->id, ant->idlen, 0));
+  } else {
+    ant4_err(ant, "parse error");
+  }
+}
+
+static inline void ant4_mul_or_div(struct ant4 *ant);
+static inline void ant4_mul_or_div2(struct ant4 *ant) {
+  int tok = ant4_next(ant);
+  if (tok == '*' || tok == '/') {
+    ant->tok = TINV;
+    ant4_mul_or_div(ant);
+    ant4_emit(ant, tok == '*' ? AMUL : ADIV, -1);
+  }
+}
+
+static inline void ant4_mul_or_div(struct ant4 *ant) {
+  ant4_primary(ant);
+  ant4_mul_or_div2(ant);
+}
+
+static inline void ant4_add_or_sub2(struct ant4 *ant) {
+  int tok = ant4_next(ant);
+  if (tok == '+' || tok == '-') {
+    ant->tok = TINV;
+    ant4_mul_or_div(ant);
+    ant4_add_or_sub2(ant);
+    ant4_emit(ant, tok == '+' ? APLUS : AMINUS, -1);
+  }
+}
+
+static inline void ant4_eq_more_less2(struct ant4 *ant) {
+  int tok = ant4_next(ant);
+  if (tok == TEQ || tok == '<' || tok == '>') {
+    ant->tok = TINV;
+    ant4_expr(ant);
+    ant4_emit(ant, tok == TEQ ? AEQ : tok == '<' ? ALT : AGT, -1);
+  }
+}
+
+static inline void ant4_assignment(struct ant4 *ant) {
+  if (ant4_isnext(ant, TVAR)) {
+    int slot = ant4_slot(ant, ant->id, ant->idlen, 0), tok = ant4_next(ant);
+    if (tok == '=' || tok == TINC || tok == TDEC) {
+      ant->tok = TINV;
+      if (tok != '=') ant4_emit2(ant, APUSH, slot);
+      ant4_expr(ant);
+      if (tok != '=') ant4_emit(ant, tok == TINC ? APLUS : AMINUS, -1);
+      ant4_emit2(ant, ASTORE, slot);
+      return;
+    }
+    ant4_emit2(ant, APUSH, slot);
+    ant4_mul_or_div2(ant);
+  } else {
+    ant4_mul_or_div(ant);
+  }
+  ant4_add_or_sub2(ant);
+  ant4_eq_more_less2(ant);
+}
+
+static void ant4_expr(struct ant4 *ant) {
+  ant4_assignment(ant);
+}
+
+// Emit AJUMP with a 16-bit operand. For a forward jump, the operand links
+// to the previous unpatched forward jump, until the next label patches it
+static inline void ant4_emit_jump(struct ant4 *ant, long operand) {
+  if (operand < -32768 || operand > 32767) ant4_err(ant, "code too big");
+  ant4_emit(ant, AJUMP, -1);
+  ant4_emit(ant, (int) (operand & 255), 0);
+  ant4_emit(ant, (int) ((unsigned long) operand >> 8 & 255), 0);
+}
+
+static inline void ant4_label(struct ant4 *ant) {
+  size_t here = (size_t) (ant->ecode - ant->scode);
+  while (ant->fwd > 0 && ant->err == NULL) {
+    uint8_t *p = &ant->scode[ant->fwd - 1];
+    long d = (long) (ant->scode + here - p);
+    ant->fwd = (size_t) (p[1] | p[2] << 8);
+    if (d > 32767) ant4_err(ant, "code too big");
+    p[1] = (uint8_t) (d & 255), p[2] = (uint8_t) (d >> 8);
+  }
+  ant->label = here;
+}
+
+static inline void ant4_stmt_list(struct ant4 *ant) {
+  int tok;
+  while ((tok = ant4_next(ant)) != TEOF) {
+    ant->tok = TINV;
+    if (tok == ';') continue;
+    if (ant->pending) ant4_emit(ant, ADROP, -1);
+    ant->pending = 0;
+    if (tok == '#') {
+      ant4_label(ant);
+    } else if (tok == '@') {
+      int back = *ant->s++ == 'b';
+      size_t at;
+      ant4_expr(ant);
+      at = (size_t) (ant->ecode - ant->scode);
+      if (back) {
+        ant4_emit_jump(ant, (long) ant->label - (long) at);
+      } else {
+        ant4_emit_jump(ant, (long) ant->fwd);
+        ant->fwd = at + 1;
+      }
+    } else {
+      ant->tok = tok;  // Not a statement token, give it back to expression
+      ant4_expr(ant);
+      ant->pending = 1;
+    }
+  }
+}
+
+// Compile infix source `str`, replacing previously compiled code. Return code
+// size, or 0 on error. The error message is stored into `ant->err`
+static inline size_t ant4_compile(struct ant4 *ant, const char *str) {
+  ant4_drop_literals(ant);
+  ant->s = str;
+  ant->eof = str + strlen(str);
+  ant->tok = TINV;
+  ant->err = NULL;
+  ant->ecode = ant->scode;
+  ant->depth = ant->maxdepth = ant->pending = 0;
+  ant->label = ant->fwd = 0;
+  ant4_stmt_list(ant);
+  ant4_label(ant);
+  ant4_emit(ant, AEOF, 0);
+  if ((size_t) (ant->ssym - ant->ecode) <
+      (size_t) ant->maxdepth * sizeof(antval_t)) {
+    ant4_err(ant, "out of memory");
+  }
+  if (ant->err != NULL) *(ant->ecode = ant->scode) = AEOF;
+  return ant->err == NULL ? (size_t) (ant->ecode - ant->scode) : 0;
+}
+
+// Run compiled code. Return the value of the last expression statement that
+// ran, or 0 if none did. Jump conditions are not expression statements
+static inline antval_t ant4_exec(struct ant4 *ant) {
+  antval_t *vals = (antval_t *) ant->esym, *base = (antval_t *) ant->ssym;
+  antval_t *sp = base, res = 0;
+  const uint8_t *pc = ant->scode;
+  for (;;) {
+    switch (*pc++) {
+      case APUSH: *--sp = vals[-(int) *pc++]; break;
+      case ASTORE: vals[-(int) *pc++] = *sp; break;
+      case ADROP: res = *sp++; break;
+      case APLUS: sp[1] += sp[0], sp++; break;
+      case AMINUS: sp[1] -= sp[0], sp++; break;
+      case AMUL: sp[1] *= sp[0], sp++; break;
+      case ADIV: sp[1] /= sp[0], sp++; break;
+      case AEQ: sp[1] = sp[1] == sp[0], sp++; break;
+      case ALT: sp[1] = sp[1] < sp[0], sp++; break;
+      case AGT: sp[1] = sp[1] > sp[0], sp++; break;
+      case AJUMP: pc = *sp++ ? pc - 1 + ant3_rel16(pc) : pc + 2; break;
+      default: return sp < base ? *sp : res;
+    }
+  }
+}
+
+// Compile and run infix source. Return its value, or 0 on error
+static inline antval_t ant4_eval(struct ant4 *ant, const char *str) {
+  return ant4_compile(ant, str) > 0 ? ant4_exec(ant) : 0;
+}
+
+// Return a pointer to the value of variable `name`, or NULL if there is no
+// such variable. Lets the host set inputs and read results between runs.
+// The next ant4_compile() can move the variable, which invalidates this
+static inline antval_t *ant4_var(struct ant4 *ant, const char *name) {
+  size_t len = strlen(name);
+  uint8_t *p;
+  for (p = ant->ssym; p < ant->esym;
+       p += ant_roundup(sizeof(antval_t) + 1 + p[sizeof(antval_t)],
+                        sizeof(antval_t))) {
+    if (len > 0 && p[sizeof(antval_t)] == len &&
+        memcmp(&p[sizeof(antval_t) + 1], name, len) == 0) {
+      return (antval_t *) p;
+    }
+  }
+  return NULL;
+}
+
+// Initialise ant4 in the memory block `buf`, which must be aligned for
+// antval_t. Return NULL if the block is too small
+static inline struct ant4 *ant4_create(void *buf, size_t len) {
+  struct ant4 *ant = (struct ant4 *) buf;
   size_t align = sizeof(antval_t);
-  if (len < sizeof(*ant) + 2 * sizeof(antval_t)) return NULL;
-  ant->ssym = ant->esym =
-      &((uint8_t *) buf)[ant_roundup(len - align - 1, align)];
+  if (len < sizeof(*ant) + 4 * align) return NULL;
+  memset(ant, 0, sizeof(*ant));
+  ant->ssym = ant->esym = (uint8_t *) buf + len / align * align;
   ant->scode = ant->ecode = (uint8_t *) (ant + 1);
-  ant->sstk = ant->estk = (antval_t *) ant->ssym;
+  *ant->scode = AEOF;
   return ant;
 }
+
+/////////////////////////////////////////////// ANT 5
+// Register VM. Each instruction names its destination and source registers
+// directly, so values do not go through the stack. Registers hold ant3
+// variables, followed by ant3 immediates, followed by ant3 stack slots
+#define ANT5_VAR(i) (i)
+#define ANT5_IMM(i) (ANT3_VARS + (i))
+#define ANT5_TMP(i) (ANT3_VARS + 10 + (i))
+#define ANT5_CONST(i) (ANT3_VARS + 20 + (i))
+
+struct ant5 {
+  antval_t r[ANT5_CONST(16)];  // Registers
+  const struct ant3_fn *fns;   // Native functions, called by RCall
+};
+
+struct ant5_insn {
+  uint8_t op;  // Opcode
+  uint8_t d;   // Destination register, or jump target instruction index
+  uint8_t a;   // First source register
+  uint8_t b;   // Second source register
+};
+
+enum {
+  // OP   d       a    b       Description
+  RDone,  //      a            Return register value
+  RMov,   // dst  a            Copy register
+  RInc,   // dst               Increment register
+  RAdd,   // dst  a    b       Add registers
+  RSub,   // dst  a    b       Subtract registers
+  RMul,   // dst  a    b       Multiply registers
+  RDiv,   // dst  a    b       Divide registers
+  REq,    // dst  a    b       Set dst to 1 if a is equal to b, else to 0
+  RLt,    // dst  a    b       Set dst to 1 if a is less than b, else to 0
+  RGt,    // dst  a    b       Set dst to 1 if a is more than b, else to 0
+  RJnz,   // idx  a            Jump if register is not zero
+  RJeq,   // idx  a    b       Jump if a is equal to b
+  RJne,   // idx  a    b       Jump if a is not equal to b
+  RJlt,   // idx  a    b       Jump if a is less than b
+  RCall,  // dst  fn   nargs   Call fns[fn] with args in dst.., result to dst
+};
+
+static inline antval_t ant5_eval(struct ant5 *ant,
+                                 const struct ant5_insn *code) {
+  const struct ant5_insn *pc = code;
+  antval_t *r = ant->r;
+  for (;;) {
+    switch (pc->op) {
+      case RDone: return r[pc->a];
+      case RMov: r[pc->d] = r[pc->a]; break;
+      case RInc: r[pc->d]++; break;
+      case RAdd: r[pc->d] = r[pc->a] + r[pc->b]; break;
+      case RSub: r[pc->d] = r[pc->a] - r[pc->b]; break;
+      case RMul: r[pc->d] = r[pc->a] * r[pc->b]; break;
+      case RDiv: r[pc->d] = r[pc->a] / r[pc->b]; break;
+      case REq: r[pc->d] = r[pc->a] == r[pc->b] ? 1 : 0; break;
+      case RLt: r[pc->d] = r[pc->a] < r[pc->b] ? 1 : 0; break;
+      case RGt: r[pc->d] = r[pc->a] > r[pc->b] ? 1 : 0; break;
+      case RJnz: pc = r[pc->a] != 0 ? code + pc->d : pc + 1; continue;
+      case RJeq: pc = r[pc->a] == r[pc->b] ? code + pc->d : pc + 1; continue;
+      case RJne: pc = r[pc->a] != r[pc->b] ? code + pc->d : pc + 1; continue;
+      case RJlt: pc = r[pc->a] < r[pc->b] ? code + pc->d : pc + 1; continue;
+      case RCall:
+        r[pc->d] = ant3_call(&ant->fns[pc->a], &r[pc->d], pc->b);
+        break;
+      default: break;
+    }
+    pc++;
+  }
+}
+
+// ant3 to ant5 translator state. Stack values are tracked symbolically as
+// registers: pushing a variable or an immediate emits no code
+struct ant5c {
+  struct ant5_insn *code;  // Output buffer
+  size_t len, n;           // Output buffer size, number of emitted insns
+  size_t block;            // First instruction of the current basic block
+  int stk[12], sp;         // Symbolic stack: register for each stack slot
+  uint8_t at[256];         // Instruction index for each ant3 code offset
+  uint8_t targets[32];     // Jump target bitmap of the ant3 code
+  antval_t *consts;        // Constant registers, for inline values
+  int nconst;              // Number of used constant registers
+};
+
+static inline void ant5c_emit(struct ant5c *c, int op, int d, int a, int b) {
+  if (c->n < c->len) {
+    c->code[c->n].op = (uint8_t) op, c->code[c->n].d = (uint8_t) d;
+    c->code[c->n].a = (uint8_t) a, c->code[c->n].b = (uint8_t) b;
+  }
+  c->n++;
+}
+
+// Copy stack slots that refer to register `reg` into their own registers,
+// before `reg` gets modified. reg < 0 means copy every slot
+static inline void ant5c_spill(struct ant5c *c, int reg) {
+  int i;
+  for (i = 0; i < c->sp; i++) {
+    if (c->stk[i] != ANT5_TMP(i) && (reg < 0 || c->stk[i] == reg)) {
+      ant5c_emit(c, RMov, ANT5_TMP(i), c->stk[i], 0);
+      c->stk[i] = ANT5_TMP(i);
+    }
+  }
+}
+
+// Pop the top stack slot into register `reg`. If the top slot was computed
+// by the last instruction, make that instruction write into `reg` directly
+static inline void ant5c_pop_to(struct ant5c *c, int reg) {
+  int src = c->stk[--c->sp], i, shared = 0;
+  struct ant5_insn *last = c->n > c->block ? &c->code[c->n - 1] : NULL;
+  for (i = 0; i < c->sp; i++) shared |= c->stk[i] == reg;
+  if (!shared && last != NULL && last->op > RInc && last->op < RJnz &&
+      last->d == src && src == ANT5_TMP(c->sp)) {
+    last->d = (uint8_t) reg;
+  } else {
+    ant5c_spill(c, reg);
+    ant5c_emit(c, RMov, reg, src, 0);
+  }
+}
+
+static inline void ant5c_binop(struct ant5c *c, int op) {
+  int b = c->stk[--c->sp], a = c->stk[--c->sp];
+  ant5c_emit(c, op, ANT5_TMP(c->sp), a, b);
+  c->stk[c->sp] = ANT5_TMP(c->sp);
+  c->sp++;
+}
+
+static inline void ant5c_push(struct ant5c *c, int reg) {
+  c->stk[c->sp++] = reg;
+}
+
+// Return a constant register that holds `val`, or -1 if they are all used
+static inline int ant5c_const(struct ant5c *c, antval_t val) {
+  int i;
+  for (i = 0; i < c->nconst && c->consts[i] != val; i++) (void) 0;
+  if (i == 16) return -1;
+  if (i == c->nconst) c->consts[c->nconst++] = val;
+  return ANT5_CONST(i);
+}
+
+// Emit a conditional jump. A compare that has just produced the condition
+// is merged into the jump. Target is set to the ant3 offset, patched later
+static inline void ant5c_jump(struct ant5c *c, int target) {
+  int cond = c->stk[--c->sp], op = RJnz, a = cond, b = 0;
+  struct ant5_insn *last = c->n > c->block ? &c->code[c->n - 1] : NULL;
+  if (last != NULL && last->d == cond && cond == ANT5_TMP(c->sp) &&
+      last->op >= RSub && last->op <= RGt && last->op != RMul &&
+      last->op != RDiv) {
+    op = last->op == RSub ? RJne : last->op == REq ? RJeq : RJlt;
+    a = last->op == RGt ? last->b : last->a;
+    b = last->op == RGt ? last->a : last->b;
+    c->n--;
+  }
+  ant5c_spill(c, -1);
+  ant5c_emit(c, op, target, a, b);
+  c->block = c->n;
+}
+
+// Translate ant3 bytecode into ant5 instructions. Registers of `ant` are
+// initialised from variables and immediates of `vm`. Return the number of
+// generated instructions, or 0 on error
+static inline size_t ant5_compile(struct ant5 *ant, struct ant3 *vm,
+                                  const uint8_t *code, struct ant5_insn *out,
+                                  size_t len) {
+  struct ant5c c;
+  size_t i, k;
+  memset(&c, 0, sizeof(c));
+  c.code = out, c.len = len;
+  memset(ant, 0, sizeof(*ant));
+  memcpy(&ant->r[ANT5_VAR(0)], vm->vars, sizeof(vm->vars));
+  memcpy(&ant->r[ANT5_IMM(0)], vm->imm, sizeof(vm->imm));
+  c.consts = &ant->r[ANT5_CONST(0)];
+  ant->fns = vm->fns;
+  if (ant3_targets(code, c.targets, sizeof(c.at)) == 0) return 0;
+  for (i = 0;; i += ant3_oplen(&code[i])) {
+    const uint8_t *p = &code[i];
+    const struct ant3_op *op = ant3_op(p[0]);
+    if (op == NULL || ant3_pops(p) > c.sp || i >= sizeof(c.at) ||
+        c.n > 255 || ant3_target(code, i) >= (long) sizeof(c.at)) {
+      return 0;
+    }
+    if (ant3_is_target(c.targets, i)) {
+      ant5c_spill(&c, -1);  // Start a new basic block
+      c.block = c.n;
+    }
+    c.at[i] = (uint8_t) c.n;
+    switch (p[0]) {
+      case Done: {  // Return stack[0], or 0 for an empty stack
+        int reg = c.sp > 0 ? c.stk[0] : ant5c_const(&c, 0);
+        if (reg < 0) return 0;
+        ant5c_emit(&c, RDone, 0, reg, 0);
+        break;
+      }
+      case IncVar:
+        ant5c_spill(&c, ANT5_VAR(p[1]));
+        ant5c_emit(&c, RInc, ANT5_VAR(p[1]), 0, 0);
+        break;
+      case Assign:
+        ant5c_push(&c, ANT5_IMM(p[2]));
+        ant5c_pop_to(&c, ANT5_VAR(p[1]));
+        break;
+      // clang-format off
+      case PushVar: ant5c_push(&c, ANT5_VAR(p[1])); break;
+      case PopVar: ant5c_pop_to(&c, ANT5_VAR(p[1])); break;
+      case PushImm: ant5c_push(&c, ANT5_IMM(p[1])); break;
+      case Pop: c.sp--; break;
+      case Plus: ant5c_binop(&c, RAdd); break;
+      case Minus: ant5c_binop(&c, RSub); break;
+      case Mul: ant5c_binop(&c, RMul); break;
+      case Div: ant5c_binop(&c, RDiv); break;
+      case Equal: ant5c_binop(&c, REq); break;
+      case Less: ant5c_binop(&c, RLt); break;
+      case More: ant5c_binop(&c, RGt); break;
+      case Jump: case JumpS: case JumpL:
+        ant5c_jump(&c, (int) ant3_target(code, i));
+        break;
+      // clang-format on
+      case CmpVarImm:
+      case JumpVarNeImm:
+        ant5c_push(&c, ANT5_VAR(p[1])), ant5c_push(&c, ANT5_IMM(p[2]));
+        ant5c_binop(&c, RSub);
+        if (p[0] == JumpVarNeImm) ant5c_jump(&c, (int) ant3_target(code, i));
+        break;
+      case AddVarVar:
+        ant5c_push(&c, ANT5_VAR(p[1])), ant5c_push(&c, ANT5_VAR(p[2]));
+        ant5c_binop(&c, RAdd);
+        break;
+      case DivVarImm:
+        ant5c_push(&c, ANT5_VAR(p[1])), ant5c_push(&c, ANT5_IMM(p[2]));
+        ant5c_binop(&c, RDiv);
+        break;
+      case AccumVar:
+        ant5c_push(&c, ANT5_VAR(p[1]));
+        c.stk[c.sp - 1] = c.stk[c.sp - 2], c.stk[c.sp - 2] = ANT5_VAR(p[1]);
+        ant5c_binop(&c, RAdd);
+        ant5c_pop_to(&c, ANT5_VAR(p[1]));
+        break;
+      case PushI8:
+      case PushI16:
+      case PushI32:
+      case PushI64: {
+        antval_t val = 0;
+        int reg;
+        ant3_push_const(vm, code, i, &val);
+        if ((reg = ant5c_const(&c, val)) < 0) return 0;
+        ant5c_push(&c, reg);
+        break;
+      }
+      case Pick:
+        if (p[1] == 0 || p[1] > c.sp) return 0;
+        ant5c_push(&c, c.stk[c.sp - p[1]]);
+        break;
+      case Nip: {  // A computed top moves into the register of its new slot
+        int top = c.stk[c.sp - 1], dst = ANT5_TMP(c.sp - 1 - p[1]);
+        struct ant5_insn *last = c.n > c.block ? &c.code[c.n - 1] : NULL;
+        c.sp -= p[1];
+        if (top >= ANT5_TMP(0) && top < ANT5_TMP(10) && top != dst) {
+          if (last != NULL && c.n <= c.len && last->op > RInc &&
+              last->op < RJnz && last->d == top) {
+            last->d = (uint8_t) dst;
+          } else {
+            ant5c_emit(&c, RMov, dst, top, 0);
+          }
+          top = dst;
+        }
+        c.stk[c.sp - 1] = top;
+        break;
+      }
+      case CallNative:
+        ant5c_spill(&c, -1);  // Arguments go to consecutive registers
+        c.sp -= p[2];
+        ant5c_emit(&c, RCall, ANT5_TMP(c.sp), p[1], p[2]);
+        ant5c_push(&c, ANT5_TMP(c.sp));
+        break;
+      case JumpVarLtVar:
+      case JumpVarLtImm:
+        ant5c_push(&c, ANT5_VAR(p[1]));
+        ant5c_push(&c, p[0] == JumpVarLtVar ? ANT5_VAR(p[2]) : ANT5_IMM(p[2]));
+        ant5c_binop(&c, RLt);
+        ant5c_jump(&c, (int) ant3_target(code, i));
+        break;
+      default:
+        return 0;
+    }
+    if (c.sp > 10) return 0;
+    if (p[0] == Done) break;
+  }
+  if (c.n > len) return 0;
+  for (k = 0; k < c.n; k++) {
+    if (out[k].op >= RJnz && out[k].op <= RJlt) out[k].d = c.at[out[k].d];
+  }
+  return c.n;
+}
@@ -15,8 +15,13 @@ static long exec_ant2(void) {
   return ant2_eval(&ant, "0=a 0=i 1000=d  # ai+i3/+=a Ii id< @b a");
 }
 
+static const unsigned char code3[] = {
+    PushVar, 0,      PushVar, 1,      Plus,      PushVar, 1, PushImm,
+    0,       Div,    Plus,    PopVar, 0,         IncVar,  1, CmpVarImm,
+    1,       1,      Jump,    0,      PushVar,   0,       Done};
+
 static long exec_ant3(void) {
-  struct ant3 ant = {{3, 1000}, {0}, {0}, 0};
+  struct ant3 ant = {{3, 1000}, {0}, {0}, 0, 0};
   unsigned char code[] = {PushVar, 0,       PushVar, 1,         Plus, PushVar,
                           1,       PushImm, 0,       Div,       Plus, PopVar,
                           0,       IncVar,  1,       CmpVarImm, 1,    1,
@@ -25,7 +30,7 @@ static long exec_ant3(void) {
 }
 
 static long exec_antx(void) {
-  struct ant3 ant = {{3, 1000}, {0}, {0}, 0};
+  struct ant3 ant = {{3, 1000}, {0}, {0}, 0, 0};
   unsigned char code[] = {PushVar, 0,       PushVar, 1,         Plus, PushVar,
                           1,       PushImm, 0,       Div,       Plus, PopVar,
                           0,       IncVar,  1,       CmpVarImm, 1,    1,
@@ -33,6 +38,98 @@ static long exec_antx(void) {
   return ant3_eval2(&ant, code);
 }
 
+static long exec_antt(void) {
+  struct ant3 ant = {{3, 1000}, {0}, {0}, 0, 0};
+  return ant3_eval_tos(&ant, code3);
+}
+
+static long exec_antl(void) {
+  struct ant3 ant = {{3, 1000}, {0}, {0}, 0, 0};
+  return ant3_eval_tail(&ant, code3);
+}
+
+static long exec_antd(void) {
+  static union ant3_cell cells[sizeof(code3)];
+  struct ant3 ant = {{3, 1000}, {0}, {0}, 0, 0};
+  if (cells[0].op == NULL) ant3_link(code3, cells, sizeof(code3));
+  return ant3_eval_linked(&ant, cells);
+}
+
+static long exec_antf(void) {
+  static struct ant3 vm = {{3, 1000}, {0}, {0}, 0, 0};
+  static unsigned char fused[sizeof(code3)];
+  struct ant3 ant;
+  if (fused[0] == Done) ant3_fuse(&vm, code3, fused, sizeof(fused));
+  ant = vm;
+  return ant3_eval2(&ant, fused);
+}
+
+static long exec_antm(void) {
+  static struct ant3 vm = {{3, 1000}, {0}, {0}, 0, 0};
+  static unsigned char out[sizeof(code3)];
+  struct ant3 ant;
+  if (out[0] == Done) ant3_divconst(&vm, code3, out, sizeof(out));
+  ant = vm;
+  return ant3_eval2(&ant, out);
+}
+
+static long exec_ant5(void) {
+  static struct ant5 ant;
+  static struct ant5_insn code[20];
+  if (code[0].op == RDone) {
+    struct ant3 vm = {{3, 1000}, {0}, {0}, 0, 0};
+    ant5_compile(&ant, &vm, code3, code, sizeof(code) / sizeof(code[0]));
+  }
+  ant.r[ANT5_VAR(0)] = ant.r[ANT5_VAR(1)] = 0;
+  return ant5_eval(&ant, code);
+}
+
+static long exec_antc(void) {
+  static struct ant3 ant = {{0}, {0}, {0}, 0, 0};
+  static unsigned char code[100];
+  if (code[0] == Done) {
+    ant_compile("a=0; i=0; b=1; c=1000; # a += i+i/3; i += b; @b i<c; a",
+                code, sizeof(code), &ant);
+  }
+  return ant3_eval2(&ant, code);
+}
+
+// The same loop, with "i + i / 3" in a function: a += f(i)
+static const unsigned char code3fn[] = {
+    Func,    1,      14,      0,                          // fn f(n) {
+    Pick,    1,      Pick,    2,         PushImm, 0,      // n + n / 3
+    Div,     Plus,   Ret,     1,                          // }
+    PushVar, 0,      PushVar, 1,         Call,    0xf2,   // a + f(i)
+    0xff,    1,      Plus,    PopVar,    0,       IncVar,
+    1,       CmpVarImm, 1,    1,         Jump,    14,
+    PushVar, 0,      Done};
+
+static long exec_antcall(void) {
+  struct ant3 ant = {{3, 1000}, {0}, {0}, 0, 0};
+  return ant3_eval_tos(&ant, code3fn);
+}
+
+static long exec_antinl(void) {
+  static struct ant3 ant = {{0}, {0}, {0}, 0, 0};
+  static unsigned char code[100];
+  if (code[0] == Done) {
+    ant_compile("fn f(n) { n + n / 3 } a=0; i=0; b=1; c=1000; "
+                "# a += f(i); i += b; @b i<c; a",
+                code, sizeof(code), &ant);
+  }
+  return ant3_eval_tos(&ant, code);
+}
+
+static long exec_ant4(void) {
+  static long mem[64];
+  static struct ant4 *ant;
+  if (ant == NULL) {
+    ant = ant4_create(mem, sizeof(mem));
+    ant4_compile(ant, "a=0; i=0; b=1; c=1000; # a += i+i/3; i += b; @b i<c; a");
+  }
+  return ant4_exec(ant);
+}
+
 static long exec_c(void) {
   long res = 0;
   for (long i = 0; i < 1000; i++) res += i + i / 3;
@@ -56,7 +153,17 @@ void loop() {
   measure_time(" ant", exec_ant);
   measure_time("ant2", exec_ant2);
   measure_time("ant3", exec_ant3);
-  measure_time("antx", exec_ant3);
+  measure_time("antx", exec_antx);
+  measure_time("antt", exec_antt);
+  measure_time("antl", exec_antl);
+  measure_time("antd", exec_antd);
+  measure_time("antf", exec_antf);
+  measure_time("antm", exec_antm);
+  measure_time("ant5", exec_ant5);
+  measure_time("antc", exec_antc);
+  measure_time("antF", exec_antcall);
+  measure_time("antI", exec_antinl);
+  measure_time("ant4", exec_ant4);
   measure_time("   c", exec_c);
   delay(1000);
 }
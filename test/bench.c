@@ -0,0 +1,261 @@
+// Copyright (c) 2022 Cesanta Software Limited
+// All rights reserved
+//
+// Host benchmark. Runs every engine on the loop from Ant.ino,
+// res += i + i / 3, and reports time per loop iteration: the median of
+// several runs, the spread across them and, where Linux perf counters are
+// available, retired CPU instructions per iteration.
+//
+// Usage: ./bench [-n ITERATIONS] [-r RUNS] [-e ENGINE] [-j]
+//   -n  loop iterations per call, default 1000
+//   -r  number of timed runs, default 11
+//   -e  run only the named engine, e.g. ant2
+//   -j  print JSON instead of a table
+
+#include "perf.h"
+#include "../ant.h"
+
+static long s_n = 1000;               // Loop iterations
+static char s_src[100], s_src2[100];  // ant and ant2 sources
+static char s_srcfn[120];             // ant source with a function
+
+// The same program as Ant.ino's code3, with the loop bound in imm[1]
+static const unsigned char s_code3[] = {
+    PushVar, 0,      PushVar, 1,      Plus,      PushVar, 1, PushImm,
+    0,       Div,    Plus,    PopVar, 0,         IncVar,  1, CmpVarImm,
+    1,       1,      Jump,    0,      PushVar,   0,       Done};
+
+// As above, with "i + i / 3" in a function
+static const unsigned char s_code3fn[] = {
+    Func,    1,      14,      0,      Pick,      1,       Pick,    2,
+    PushImm, 0,      Div,     Plus,   Ret,       1,       PushVar, 0,
+    PushVar, 1,      Call,    0xf2,   0xff,      1,       Plus,    PopVar,
+    0,       IncVar, 1,       CmpVarImm, 1,      1,       Jump,    14,
+    PushVar, 0,      Done};
+
+static struct ant3 s_vm;  // Initial ant3 state: imm[0] is 3, imm[1] is n
+static struct ant3 s_vmf, s_vmd, s_vmc, s_vmi;  // States of compiled code
+static unsigned char s_fused[32], s_divc[32], s_codec[100], s_codei[100];
+static union ant3_cell s_cells[sizeof(s_code3)];
+static struct ant5 s_ant5;
+static struct ant5_insn s_code5[20];
+static long s_mem4[64];
+static struct ant4 *s_ant4;
+static ant3_jit_t s_jit;
+
+static long exec_ant(void) {
+  struct ant ant = ANT_INITIALIZER;
+  return ant_eval(&ant, s_src);
+}
+
+static long exec_ant2(void) {
+  struct ant2 ant = ANT2_INITIALIZER;
+  return ant2_eval(&ant, s_src2);
+}
+
+static long exec_ant3(void) {
+  struct ant3 ant = s_vm;
+  return ant3_eval(&ant, s_code3);
+}
+
+static long exec_antx(void) {
+  struct ant3 ant = s_vm;
+  return ant3_eval2(&ant, s_code3);
+}
+
+static long exec_antt(void) {
+  struct ant3 ant = s_vm;
+  return ant3_eval_tos(&ant, s_code3);
+}
+
+static long exec_antl(void) {
+  struct ant3 ant = s_vm;
+  return ant3_eval_tail(&ant, s_code3);
+}
+
+static long exec_antd(void) {
+  struct ant3 ant = s_vm;
+  return ant3_eval_linked(&ant, s_cells);
+}
+
+static long exec_antf(void) {
+  struct ant3 ant = s_vmf;
+  return ant3_eval2(&ant, s_fused);
+}
+
+static long exec_antm(void) {
+  struct ant3 ant = s_vmd;
+  return ant3_eval2(&ant, s_divc);
+}
+
+static long exec_ant5(void) {
+  s_ant5.r[ANT5_VAR(0)] = s_ant5.r[ANT5_VAR(1)] = 0;
+  return ant5_eval(&s_ant5, s_code5);
+}
+
+static long exec_antc(void) {
+  return ant3_eval2(&s_vmc, s_codec);
+}
+
+static long exec_antcall(void) {
+  struct ant3 ant = s_vm;
+  return ant3_eval_tos(&ant, s_code3fn);
+}
+
+static long exec_antinl(void) {
+  return ant3_eval_tos(&s_vmi, s_codei);
+}
+
+static long exec_antj(void) {
+  struct ant3 ant = s_vm;
+  return s_jit(&ant);
+}
+
+static long exec_ant4(void) {
+  return ant4_exec(s_ant4);
+}
+
+static long exec_c(void) {
+  volatile long n = s_n;
+  long i, res = 0;
+  for (i = 0; i < n; i++) res += i + i / 3;
+  return res;
+}
+
+struct engine {
+  const char *name;  // Name, as in Ant.ino
+  long (*fn)(void);  // Run the loop once, return the result
+};
+
+static const struct engine s_engines[] = {
+    {"ant", exec_ant},       {"ant2", exec_ant2},  {"ant3", exec_ant3},
+    {"antx", exec_antx},     {"antt", exec_antt},  {"antl", exec_antl},
+    {"antd", exec_antd},     {"antf", exec_antf},  {"antm", exec_antm},
+    {"ant5", exec_ant5},     {"antc", exec_antc},  {"antF", exec_antcall},
+    {"antI", exec_antinl},   {"antj", exec_antj},  {"ant4", exec_ant4},
+    {"c", exec_c},           {NULL, NULL}};
+
+// Prepare sources and compiled code of every engine for `s_n` iterations
+static void setup(void) {
+  const char *loop = "# a += i+i/3; i += b; @b i<c; a";
+  snprintf(s_src, sizeof(s_src), "a=0; i=0; b=1; c=%ld; %s", s_n, loop);
+  snprintf(s_src2, sizeof(s_src2), "0=a 0=i %ld=d  # ai+i3/+=a Ii id< @b a",
+           s_n);
+  snprintf(s_srcfn, sizeof(s_srcfn),
+           "fn f(n) { n + n / 3 } a=0; i=0; b=1; c=%ld; "
+           "# a += f(i); i += b; @b i<c; a",
+           s_n);
+  s_vm.imm[0] = 3, s_vm.imm[1] = s_n;
+  ant3_link(s_code3, s_cells, sizeof(s_code3));
+  s_vmf = s_vmd = s_vm;
+  ant3_fuse(&s_vmf, s_code3, s_fused, sizeof(s_fused));
+  ant3_divconst(&s_vmd, s_code3, s_divc, sizeof(s_divc));
+  ant5_compile(&s_ant5, &s_vm, s_code3, s_code5,
+               sizeof(s_code5) / sizeof(s_code5[0]));
+  if (ant_compile(s_src, s_codec, sizeof(s_codec), &s_vmc) == 0 ||
+      ant_compile(s_srcfn, s_codei, sizeof(s_codei), &s_vmi) == 0) {
+    fprintf(stderr, "cannot compile benchmark sources\n");
+    exit(1);
+  }
+  s_ant4 = ant4_create(s_mem4, sizeof(s_mem4));
+  if (ant4_compile(s_ant4, s_src) == 0) exit(1);
+  s_jit = ant3_jit(s_code3);
+}
+
+// Call `fn` `calls` times. Return elapsed nanoseconds, store the number of
+// instructions into `*insns` if the counter is available
+static double run(long (*fn)(void), long calls, struct counters *c,
+                  double *insns) {
+  long i;
+  counters_start(c);
+  for (i = 0; i < calls; i++) fn();
+  counters_stop(c);
+  if (c->val[CNT_INSNS] >= 0) *insns = c->val[CNT_INSNS];
+  return c->ns;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *only = NULL;
+  int i, k, runs = 11, json = 0, first = 1;
+  struct counters c;
+  long expected = 0, n;
+  double t[64];
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      s_n = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      runs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+      only = argv[++i];
+    } else if (strcmp(argv[i], "-j") == 0) {
+      json = 1;
+    } else {
+      fprintf(stderr, "usage: %s [-n ITERATIONS] [-r RUNS] [-e ENGINE] [-j]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  // Keep the slowest engine, ant, within seconds per run
+  if (s_n < 1 || s_n > 1000000 || runs < 1 || runs > 64) {
+    fprintf(stderr, "bad -n or -r value\n");
+    return 1;
+  }
+  for (n = 0; n < s_n; n++) expected += n + n / 3;
+  setup();
+  counters_open(&c, 1 << CNT_INSNS);
+  if (json) {
+    printf("{\"iterations\": %ld, \"runs\": %d, \"engines\": [", s_n, runs);
+  } else {
+    printf("%-6s %10s %10s %10s %8s %12s\n", "engine", "ns/iter", "min",
+           "max", "spread", "insns/iter");
+  }
+  for (k = 0; s_engines[k].name != NULL; k++) {
+    const struct engine *e = &s_engines[k];
+    double insns = -1, med, spread;
+    long calls;
+    if (only != NULL && strcmp(only, e->name) != 0) continue;
+    if (e->fn == exec_antj && s_jit == NULL) continue;  // No JIT here
+    if (e->fn() != expected) {
+      fprintf(stderr, "%s: result %ld, expected %ld\n", e->name, e->fn(),
+              expected);
+      return 1;
+    }
+    // Size runs to take about 10 milliseconds each
+    calls = (long) (1e7 / (run(e->fn, 1, &c, &insns) + 1)) + 1;
+    for (i = 0; i < runs; i++) {
+      t[i] = run(e->fn, calls, &c, &insns) / ((double) calls * (double) s_n);
+    }
+    if (insns >= 0) insns /= (double) calls * (double) s_n;
+    qsort(t, (size_t) runs, sizeof(t[0]), cmp_double);
+    med = t[runs / 2];
+    spread = med > 0 ? (t[runs - 1] - t[0]) / med * 100 : 0;
+    if (json) {
+      printf("%s\n  {\"name\": \"%s\", \"ns_per_iter\": %.3f, "
+             "\"min\": %.3f, \"max\": %.3f, \"spread_pct\": %.1f, ",
+             first ? "" : ",", e->name, med, t[0], t[runs - 1], spread);
+      if (insns >= 0) {
+        printf("\"insns_per_iter\": %.1f}", insns);
+      } else {
+        printf("\"insns_per_iter\": null}");
+      }
+    } else {
+      printf("%-6s %10.2f %10.2f %10.2f %7.1f%%", e->name, med, t[0],
+             t[runs - 1], spread);
+      if (insns >= 0) {
+        printf(" %12.1f\n", insns);
+      } else {
+        printf(" %12s\n", "-");
+      }
+    }
+    first = 0;
+  }
+  if (json) printf("\n]}\n");
+  counters_close(&c);
+  ant3_jit_free(s_jit);
+  return 0;
+}
@@ -0,0 +1,204 @@
+// Copyright (c) 2022 Cesanta Software Limited
+// All rights reserved
+//
+// Workload generator. Emits the same pseudo-random program as infix ant
+// source, postfix ant2 source and ant3 bytecode, so that every engine can
+// run it and the results can be compared. A program initializes its
+// variables, then runs a loop of statements like
+//
+//   c = (b + 3 * e + (a < d) + 41) / 6;
+//
+// and returns the value of `a`. Every statement divides its sum by one more
+// than the largest possible sum of its terms over the largest value, so
+// values stay below GEN_MAX and no engine can overflow.
+//
+// Nested loops are flattened into a single loop with a counter per level,
+// since ant labels are found by scanning for the nearest '#'. The innermost
+// counter is incremented every iteration and carries into the outer one:
+//
+//   z += 1; y += z > 9; z = (z < 10) * z; @b y < 10
+//
+// The generated constructs avoid ant's interpreter quirks: a statement
+// never starts with a variable followed by '*' or '/', and there is no '-'
+
+#pragma once
+
+#include <stdarg.h>
+#include "../ant.h"
+
+#define GEN_MAX 1000  // Variable values and literals are below this
+#define GEN_LITS 16   // Distinct literals in terms, to fit ant4's symbols
+
+struct gen {
+  unsigned seed;  // Random seed. The same parameters give the same program
+  size_t size;    // Approximate size of the infix source, in bytes
+  int depth;      // Loop nesting depth, 0 for straight-line code
+  int nvars;      // Number of variables besides loop counters
+  int count;      // Iterations of each loop level, at least 1
+};
+
+struct gen_out {
+  char *infix, *postfix;     // Sources, NUL-terminated
+  uint8_t *code;             // ant3 bytecode, ends with Done
+  size_t isize, psize, csize;  // Buffer sizes
+  size_t ilen, plen, clen;   // Lengths written so far
+  size_t stmts;              // Number of statements in the loop body
+  int overflow;              // A buffer was too small
+};
+
+static inline unsigned gen_rand(unsigned *seed, unsigned n) {
+  *seed = *seed * 1103515245 + 12345;
+  return (*seed >> 16) % n;
+}
+
+static inline void gen_vprint(char *buf, size_t size, size_t *len,
+                              int *overflow, const char *fmt, va_list ap) {
+  int n = vsnprintf(buf + *len, size - *len, fmt, ap);
+  if (n < 0 || (size_t) n >= size - *len) {
+    *overflow = 1;
+  } else {
+    *len += (size_t) n;
+  }
+}
+
+// Append to the infix source
+static inline void gen_i(struct gen_out *o, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  gen_vprint(o->infix, o->isize, &o->ilen, &o->overflow, fmt, ap);
+  va_end(ap);
+}
+
+// Append to the postfix source
+static inline void gen_p(struct gen_out *o, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  gen_vprint(o->postfix, o->psize, &o->plen, &o->overflow, fmt, ap);
+  va_end(ap);
+}
+
+// Append `n` bytes to the bytecode
+static inline void gen_c(struct gen_out *o, int n, int b0, int b1, int b2) {
+  int i, b[3];
+  b[0] = b0, b[1] = b1, b[2] = b2;
+  for (i = 0; i < n; i++) {
+    if (o->clen >= o->csize) {
+      o->overflow = 1;
+    } else {
+      o->code[o->clen++] = (uint8_t) b[i];
+    }
+  }
+}
+
+// Emit a push of literal `v`, 0 <= v < 65536, into bytecode
+static inline void gen_lit(struct gen_out *o, long v) {
+  if (v < 128) {
+    gen_c(o, 2, PushI8, (int) v, 0);
+  } else {
+    gen_c(o, 3, PushI16, (int) (v & 255), (int) (v >> 8));
+  }
+}
+
+// Emit one term of a sum, return the largest value of the term divided by
+// GEN_MAX, i.e. its weight in the statement's divisor
+static inline int gen_term(struct gen_out *o, unsigned *seed, const long *lits,
+                           int nvars) {
+  int a = 'a' + (int) gen_rand(seed, (unsigned) nvars);
+  int b = 'a' + (int) gen_rand(seed, (unsigned) nvars);
+  long lit = lits[gen_rand(seed, GEN_LITS)];
+  int c = 2 + (int) gen_rand(seed, 8);
+  switch (gen_rand(seed, 5)) {
+    case 0:
+      gen_i(o, "%c", a), gen_p(o, "%c ", a);
+      gen_c(o, 2, PushVar, a - 'a', 0);
+      return 1;
+    case 1:
+      gen_i(o, "%ld", lit), gen_p(o, "%ld ", lit);
+      gen_lit(o, lit);
+      return 1;
+    case 2:
+      gen_i(o, "%d * %c", c, a), gen_p(o, "%d %c * ", c, a);
+      gen_lit(o, c), gen_c(o, 3, PushVar, a - 'a', Mul);
+      return c;
+    case 3:
+      gen_i(o, "(%c < %c)", a, b), gen_p(o, "%c %c < ", a, b);
+      gen_c(o, 2, PushVar, a - 'a', 0), gen_c(o, 3, PushVar, b - 'a', Less);
+      return 1;
+    default:
+      gen_i(o, "(%c > %ld)", a, lit), gen_p(o, "%c %ld > ", a, lit);
+      gen_c(o, 2, PushVar, a - 'a', 0), gen_lit(o, lit);
+      gen_c(o, 1, More, 0, 0);
+      return 1;
+  }
+}
+
+// Emit "x = (t1 + ... + tn) / d;"
+static inline void gen_stmt(struct gen_out *o, unsigned *seed,
+                            const long *lits, int nvars) {
+  int x = 'a' + (int) gen_rand(seed, (unsigned) nvars);
+  int i, n = 1 + (int) gen_rand(seed, 4), d = 1;
+  gen_i(o, "%c = (", x);
+  for (i = 0; i < n; i++) {
+    if (i > 0) gen_i(o, " + ");
+    d += gen_term(o, seed, lits, nvars);
+    if (i > 0) gen_p(o, "+ "), gen_c(o, 1, Plus, 0, 0);
+  }
+  gen_i(o, ") / %d; ", d), gen_p(o, "%d / =%c ", d, x);
+  gen_lit(o, d), gen_c(o, 3, Div, PopVar, x - 'a');
+  o->stmts++;
+}
+
+// Generate the program described by `g` into the buffers of `o`. Return 0
+// if a buffer is too small or the parameters are out of range
+static inline int gen_program(const struct gen *g, struct gen_out *o) {
+  unsigned seed = g->seed;
+  long lits[GEN_LITS], label = 0;
+  unsigned ofs;
+  int i, k;
+  o->ilen = o->plen = o->clen = o->stmts = 0, o->overflow = 0;
+  if (g->nvars < 1 || g->depth < 0 || g->nvars + g->depth > 26 ||
+      g->count < 1 || g->count >= GEN_MAX) {
+    return 0;
+  }
+  for (i = 0; i < GEN_LITS; i++) lits[i] = gen_rand(&seed, GEN_MAX);
+  // Initial values. Loop counters are the last letters, outermost first
+  for (i = 0; i < g->nvars + g->depth; i++) {
+    long v = i < g->nvars ? (long) gen_rand(&seed, GEN_MAX) : 0;
+    int x = i < g->nvars ? 'a' + i : 'z' - g->depth + 1 + (i - g->nvars);
+    gen_i(o, "%c = %ld; ", x, v), gen_p(o, "%ld =%c ", v, x);
+    gen_lit(o, v), gen_c(o, 2, PopVar, x - 'a', 0);
+  }
+  if (g->depth > 0) {
+    gen_i(o, "# "), gen_p(o, "# ");
+    label = (long) o->clen;
+  }
+  do {
+    gen_stmt(o, &seed, lits, g->nvars);
+  } while (o->ilen < g->size && !o->overflow);
+  if (g->depth > 0) {
+    int n = g->count;
+    gen_i(o, "z += 1; "), gen_p(o, "Iz ");
+    gen_c(o, 2, IncVar, 'z' - 'a', 0);
+    for (k = 'z'; k > 'z' - g->depth + 1; k--) {
+      // Carry from counter k into k - 1, and wrap k around
+      gen_i(o, "%c += %c > %d; %c = (%c < %d) * %c; ", k - 1, k, n - 1, k, k,
+            n, k);
+      gen_p(o, "%c %c %d > + =%c %c %d < %c * =%c ", k - 1, k, n - 1, k - 1,
+            k, n, k, k);
+      gen_c(o, 2, PushVar, k - 'a', 0), gen_lit(o, n - 1);
+      gen_c(o, 3, More, AccumVar, k - 1 - 'a');
+      gen_c(o, 2, PushVar, k - 'a', 0), gen_lit(o, n);
+      gen_c(o, 3, Less, PushVar, k - 'a');
+      gen_c(o, 3, Mul, PopVar, k - 'a');
+    }
+    k = 'z' - g->depth + 1;
+    gen_i(o, "@b %c < %d; ", k, n), gen_p(o, "%c %d < @b ", k, n);
+    gen_c(o, 2, PushVar, k - 'a', 0), gen_lit(o, n);
+    gen_c(o, 1, Less, 0, 0);
+    ofs = (unsigned) (label - (long) o->clen);  // Relative to the jump
+    gen_c(o, 3, JumpL, (int) (ofs & 255), (int) (ofs >> 8 & 255));
+  }
+  gen_i(o, "a"), gen_p(o, "a");
+  gen_c(o, 3, PushVar, 0, Done);
+  return !o->overflow;
+}
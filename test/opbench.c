@@ -0,0 +1,334 @@
+// Copyright (c) 2022 Cesanta Software Limited
+// All rights reserved
+//
+// Per-opcode microbenchmark. For every unit below, builds a loop of 16
+// copies of the unit and runs it on every ant3 dispatch strategy. The cost
+// of an empty loop is subtracted, so the result is the cost of one unit:
+// wall time, and CPU cycles, instructions, branch misses and L1 data cache
+// misses where perf counters are available. A difference below one clock
+// tick or one count per run is noise: it is reported as 0 and marked. The
+// empty loop itself is reported per loop iteration.
+//
+// Usage: ./opbench [-n ITERATIONS] [-r RUNS] [-m METRIC] [-j]
+//   -n  loop iterations per run, default 100000
+//   -r  number of runs, the median is reported, default 7
+//   -m  metric of the table: ns (default), cycles, insns, br-miss, l1d-miss
+//   -j  print all metrics as JSON instead of a table
+
+#include "perf.h"
+#include "../ant.h"
+
+#define UNITS 16  // Copies of a unit in the loop body
+
+// A unit is a few instructions with no net stack effect. The loop keeps
+// one value on the stack for units that start with an operator. Variables:
+// 1 is the loop counter, 2 is 5, 3 is 1. imm[0] is the loop bound, imm[1]
+// is 9. Native function 0 returns its argument
+struct unit {
+  const char *name;    // Unit name, e.g. the opcode under test
+  uint8_t code[8];     // Instructions
+  size_t len;          // Size of the instructions
+};
+
+// clang-format off
+static const struct unit s_units[] = {
+  {"PushVar,Pop",   {PushVar, 2, Pop}, 3},
+  {"PushI8,Pop",    {PushI8, 7, Pop}, 3},
+  {"PushImm,Pop",   {PushImm, 1, Pop}, 3},
+  {"Pick,Pop",      {Pick, 1, Pop}, 3},
+  {"Pick,Nip",      {Pick, 1, Nip, 1}, 4},
+  {"IncVar",        {IncVar, 2}, 2},
+  {"PushVar,PopVar", {PushVar, 3, PopVar, 2}, 4},
+  {"PushVar,AccumVar", {PushVar, 3, AccumVar, 2}, 4},
+  {"AddVarVar,Pop", {AddVarVar, 2, 3, Pop}, 4},
+  {"DivVarImm,Pop", {DivVarImm, 2, 1, Pop}, 4},
+  {"PushVar,Plus",  {PushVar, 3, Plus}, 3},
+  {"PushVar,Minus", {PushVar, 3, Minus}, 3},
+  {"PushVar,Mul",   {PushVar, 3, Mul}, 3},
+  {"PushVar,Div",   {PushVar, 3, Div}, 3},
+  {"PushVar,Less",  {PushVar, 3, Less}, 3},
+  {"PushVar,JumpS", {PushVar, 3, JumpS, 2}, 4},
+  {"CallNative",    {CallNative, 0, 1}, 3},
+  {"mix", {0}, 0},  // Pseudo-random sequence of the PushVar,<op> units
+};
+// clang-format on
+#define NUNITS (sizeof(s_units) / sizeof(s_units[0]))
+
+static antval_t ident(antval_t x) {
+  return x;
+}
+
+static const struct ant3_fn s_fns[] = {ANT3_FN("ident", ident, 1),
+                                       ANT3_FN(NULL, NULL, 0)};
+
+static struct ant3 s_vm;  // Initial state
+static uint8_t s_code[128];
+static union ant3_cell s_cells[128];
+static struct ant5 s_ant5;
+static struct ant5_insn s_code5[128];
+static ant3_jit_t s_jit;
+
+// Build the loop of `n` copies of unit `u` into s_code
+static size_t build(const struct unit *u, int n) {
+  unsigned seed = 7;
+  size_t len = 0, label;
+  int k;
+  s_code[len++] = PushVar, s_code[len++] = 2;
+  label = len;
+  for (k = 0; k < n; k++) {
+    const struct unit *v = u;
+    if (u->len == 0) {  // Mix: pick one of the PushVar,<op> units
+      seed = seed * 1103515245 + 12345;
+      v = &s_units[10 + (seed >> 16) % 5];  // Plus to Less
+    }
+    memcpy(&s_code[len], v->code, v->len);
+    len += v->len;
+  }
+  s_code[len++] = IncVar, s_code[len++] = 1;
+  s_code[len++] = CmpVarImm, s_code[len++] = 1, s_code[len++] = 0;
+  s_code[len++] = Jump, s_code[len++] = (uint8_t) label;
+  s_code[len++] = Done;
+  return len;
+}
+
+static int prep_none(size_t len) {
+  (void) len;
+  return 1;
+}
+
+static int prep_linked(size_t len) {
+  return ant3_link(s_code, s_cells, len) > 0;
+}
+
+static int prep_jit(size_t len) {
+  (void) len;
+  ant3_jit_free(s_jit);
+  return (s_jit = ant3_jit(s_code)) != NULL;
+}
+
+static int prep_ant5(size_t len) {
+  (void) len;
+  s_ant5.fns = s_fns;
+  return ant5_compile(&s_ant5, &s_vm, s_code, s_code5,
+                      sizeof(s_code5) / sizeof(s_code5[0])) > 0;
+}
+
+static antval_t run_eval(struct ant3 *vm) {
+  return ant3_eval(vm, s_code);
+}
+
+static antval_t run_eval2(struct ant3 *vm) {
+  return ant3_eval2(vm, s_code);
+}
+
+static antval_t run_tos(struct ant3 *vm) {
+  return ant3_eval_tos(vm, s_code);
+}
+
+static antval_t run_tail(struct ant3 *vm) {
+  return ant3_eval_tail(vm, s_code);
+}
+
+static antval_t run_linked(struct ant3 *vm) {
+  return ant3_eval_linked(vm, s_cells);
+}
+
+static antval_t run_jit(struct ant3 *vm) {
+  return s_jit(vm);
+}
+
+static antval_t run_ant5(struct ant3 *vm) {
+  int i;
+  for (i = 1; i < 4; i++) s_ant5.r[ANT5_VAR(i)] = vm->vars[i];
+  return ant5_eval(&s_ant5, s_code5);
+}
+
+struct engine {
+  const char *name;                    // Column name
+  int (*prep)(size_t len);             // Prepare s_code, return 0 on error
+  antval_t (*run)(struct ant3 *vm);    // Run prepared code
+};
+
+static const struct engine s_engines[] = {
+    {"switch", prep_none, run_eval},     {"goto", prep_none, run_eval2},
+    {"tos", prep_none, run_tos},         {"tail", prep_none, run_tail},
+    {"linked", prep_linked, run_linked}, {"ant5", prep_ant5, run_ant5},
+    {"jit", prep_jit, run_jit}};
+#define NENGINES (sizeof(s_engines) / sizeof(s_engines[0]))
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+// Run prepared code `runs` times, store median time and counts of a run
+// into m[0] and m[1 + CNT_*]
+static void measure(const struct engine *e, int runs, struct counters *c,
+                   double *m) {
+  double v[1 + CNT_MAX][32];
+  int i, k;
+  for (i = 0; i < runs; i++) {
+    struct ant3 vm = s_vm;
+    counters_start(c);
+    e->run(&vm);
+    counters_stop(c);
+    v[0][i] = c->ns;
+    for (k = 0; k < CNT_MAX; k++) v[1 + k][i] = c->val[k];
+  }
+  for (k = 0; k < 1 + CNT_MAX; k++) {
+    qsort(v[k], (size_t) runs, sizeof(v[k][0]), cmp_double);
+    m[k] = v[k][runs / 2];
+  }
+}
+
+// Print a table cell: "-" if value `v` is missing, "0*" if it is below
+// the resolution
+static void print_cell(double v, int ok, int below) {
+  if (!ok || v < 0) {
+    printf(" %8s", "-");
+  } else if (below) {
+    printf(" %8s", "0*");
+  } else {
+    printf(" %8.2f", v);
+  }
+}
+
+// Print the metrics of a JSON result: null if a value is missing. Values
+// below the resolution are 0 and listed in "below"
+static void print_json(const double *v, const int *below) {
+  int k, n = 0;
+  printf(", \"ns\": %.3f", v[0]);
+  for (k = 0; k < CNT_MAX; k++) {
+    if (v[1 + k] < 0) {
+      printf(", \"%s\": null", cnt_names[k]);
+    } else {
+      printf(", \"%s\": %.3f", cnt_names[k], v[1 + k]);
+    }
+  }
+  printf(", \"below\": [");
+  for (k = 0; k < 1 + CNT_MAX; k++) {
+    if (below != NULL && below[k]) {
+      printf("%s\"%s\"", n++ ? ", " : "", k ? cnt_names[k - 1] : "ns");
+    }
+  }
+  printf("]}");
+}
+
+int main(int argc, char *argv[]) {
+  static double res[NUNITS][NENGINES][1 + CNT_MAX];
+  static int ok[NUNITS][NENGINES], below[NUNITS][NENGINES][1 + CNT_MAX];
+  static double base[NENGINES][1 + CNT_MAX];
+  double m[1 + CNT_MAX], tick[1 + CNT_MAX], n = 100000;
+  int i, k, j, runs = 7, json = 0, metric = 0, first = 1, marked = 0;
+  struct counters c;
+  struct timespec ts = {0, 1};
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      n = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      runs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+      const char *name = argv[++i];
+      for (metric = CNT_MAX; metric > 0; metric--) {
+        if (strcmp(name, cnt_names[metric - 1]) == 0) break;
+      }
+      if (metric == 0 && strcmp(name, "ns") != 0) break;
+    } else if (strcmp(argv[i], "-j") == 0) {
+      json = 1;
+    } else {
+      break;
+    }
+  }
+  if (i < argc || n < 1 || n > 1e9 || runs < 1 || runs > 32) {
+    fprintf(stderr, "usage: %s [-n ITERATIONS] [-r RUNS] [-m METRIC] [-j]\n",
+            argv[0]);
+    return 1;
+  }
+  s_vm.imm[0] = (antval_t) n, s_vm.imm[1] = 9;
+  s_vm.vars[2] = 5, s_vm.vars[3] = 1;
+  s_vm.fns = s_fns;
+  counters_open(&c, (1 << CNT_MAX) - 1);
+  if (metric > 0 && c.fd[metric - 1] < 0) {
+    fprintf(stderr, "%s: counter not available\n", cnt_names[metric - 1]);
+    return 1;
+  }
+  // Resolution of a run: one clock tick, or one count
+  clock_getres(CLOCK_MONOTONIC, &ts);
+  tick[0] = (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+  for (k = 0; k < CNT_MAX; k++) tick[1 + k] = 1;
+  for (j = 0; j < (int) NENGINES; j++) {
+    const struct engine *e = &s_engines[j];
+    size_t len = build(&s_units[0], 0);
+    for (k = 0; k < 1 + CNT_MAX; k++) base[j][k] = -1;
+    if (ant3_verify(s_code, len, s_fns) < 0 || !e->prep(len)) continue;
+    measure(e, runs, &c, base[j]);
+    for (i = 0; i < (int) NUNITS; i++) {
+      len = build(&s_units[i], UNITS);
+      if (ant3_verify(s_code, len, s_fns) < 0) {
+        fprintf(stderr, "%s: bad unit\n", s_units[i].name);
+        return 1;
+      }
+      if (!e->prep(len)) continue;
+      measure(e, runs, &c, m);
+      for (k = 0; k < 1 + CNT_MAX; k++) {
+        if (m[k] < 0) {
+          res[i][j][k] = -1;
+        } else if (m[k] - base[j][k] < tick[k]) {
+          res[i][j][k] = 0, below[i][j][k] = 1;
+          if (k == metric) marked = 1;
+        } else {
+          res[i][j][k] = (m[k] - base[j][k]) / (n * UNITS);
+        }
+      }
+      ok[i][j] = 1;
+    }
+  }
+  if (json) {
+    printf("{\"iterations\": %.0f, \"units\": %d, \"resolution_ns\": %.0f,",
+           n, UNITS, tick[0]);
+    printf(" \"baseline\": [");
+    for (j = 0; j < (int) NENGINES; j++) {
+      if (base[j][0] < 0) continue;
+      for (k = 0; k < 1 + CNT_MAX; k++) {
+        m[k] = base[j][k] < 0 ? -1 : base[j][k] / n;
+      }
+      printf("%s\n  {\"engine\": \"%s\"", first ? "" : ",",
+             s_engines[j].name);
+      print_json(m, NULL);
+      first = 0;
+    }
+    printf("\n], \"results\": [");
+    first = 1;
+    for (i = 0; i < (int) NUNITS; i++) {
+      for (j = 0; j < (int) NENGINES; j++) {
+        if (!ok[i][j]) continue;
+        printf("%s\n  {\"unit\": \"%s\", \"engine\": \"%s\"", first ? "" : ",",
+               s_units[i].name, s_engines[j].name);
+        print_json(res[i][j], below[i][j]);
+        first = 0;
+      }
+    }
+    printf("\n]}\n");
+  } else {
+    printf("%s per unit%s\n%-18s", metric ? cnt_names[metric - 1] : "ns",
+           counters_any(&c) ? "" : " (no perf counters)", "unit");
+    for (j = 0; j < (int) NENGINES; j++) printf(" %8s", s_engines[j].name);
+    printf("\n%-18s", "(empty loop)");
+    for (j = 0; j < (int) NENGINES; j++) {
+      print_cell(base[j][metric] < 0 ? -1 : base[j][metric] / n,
+                 base[j][0] >= 0, 0);
+    }
+    printf("\n");
+    for (i = 0; i < (int) NUNITS; i++) {
+      printf("%-18s", s_units[i].name);
+      for (j = 0; j < (int) NENGINES; j++) {
+        print_cell(res[i][j][metric], ok[i][j], below[i][j][metric]);
+      }
+      printf("\n");
+    }
+    if (marked) printf("0* below the resolution of a run\n");
+  }
+  counters_close(&c);
+  ant3_jit_free(s_jit);
+  return 0;
+}
@@ -0,0 +1,117 @@
+// Copyright (c) 2022 Cesanta Software Limited
+// All rights reserved
+//
+// Hardware counters for the host benchmarks. On Linux, counters are read
+// with perf_event_open(), counting user space events of the calling thread.
+// A counter that the kernel, its perf_event_paranoid setting or the machine
+// does not provide reads as -1. Wall time always comes from clock_gettime()
+
+#pragma once
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+enum { CNT_CYCLES, CNT_INSNS, CNT_BRMISS, CNT_L1MISS, CNT_MAX };
+
+static const char *const cnt_names[CNT_MAX] = {"cycles", "insns", "br-miss",
+                                               "l1d-miss"};
+
+struct counters {
+  int fd[CNT_MAX];        // Counter file descriptors, -1 if not available
+  double val[CNT_MAX];    // Counts of the last measured region, or -1
+  double ns;              // Wall time of the last measured region
+  double start;           // Wall time at counters_start()
+};
+
+static inline double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+// Open the counters whose bits are set in `mask`, e.g. 1 << CNT_INSNS
+static inline void counters_open(struct counters *c, int mask) {
+  int i;
+  for (i = 0; i < CNT_MAX; i++) {
+    c->fd[i] = -1, c->val[i] = -1;
+#ifdef __linux__
+    if (mask & (1 << i)) {
+      struct perf_event_attr pe;
+      memset(&pe, 0, sizeof(pe));
+      pe.size = sizeof(pe);
+      pe.type = i == CNT_L1MISS ? PERF_TYPE_HW_CACHE : PERF_TYPE_HARDWARE;
+      pe.config = i == CNT_CYCLES   ? PERF_COUNT_HW_CPU_CYCLES
+                  : i == CNT_INSNS  ? PERF_COUNT_HW_INSTRUCTIONS
+                  : i == CNT_BRMISS ? PERF_COUNT_HW_BRANCH_MISSES
+                                    : PERF_COUNT_HW_CACHE_L1D |
+                                          PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                                          PERF_COUNT_HW_CACHE_RESULT_MISS
+                                              << 16;
+      pe.disabled = 1;
+      pe.exclude_kernel = 1;
+      pe.exclude_hv = 1;
+      c->fd[i] = (int) syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+    }
+#endif
+  }
+  (void) mask;
+  c->ns = c->start = 0;
+}
+
+// Return true if at least one hardware counter is available
+static inline int counters_any(const struct counters *c) {
+  int i;
+  for (i = 0; i < CNT_MAX; i++) {
+    if (c->fd[i] >= 0) return 1;
+  }
+  return 0;
+}
+
+static inline void counters_start(struct counters *c) {
+#ifdef __linux__
+  int i;
+  for (i = 0; i < CNT_MAX; i++) {
+    if (c->fd[i] >= 0) ioctl(c->fd[i], PERF_EVENT_IOC_RESET, 0);
+    if (c->fd[i] >= 0) ioctl(c->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+#endif
+  c->start = now_ns();
+}
+
+static inline void counters_stop(struct counters *c) {
+  int i;
+  c->ns = now_ns() - c->start;
+  for (i = 0; i < CNT_MAX; i++) {
+#ifdef __linux__
+    long long count;
+    if (c->fd[i] >= 0) ioctl(c->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    if (c->fd[i] >= 0 && read(c->fd[i], &count, sizeof(count)) ==
+                             (ssize_t) sizeof(count)) {
+      c->val[i] = (double) count;
+      continue;
+    }
+#endif
+    c->val[i] = -1;
+  }
+}
+
+static inline void counters_close(struct counters *c) {
+#ifdef __linux__
+  int i;
+  for (i = 0; i < CNT_MAX; i++) {
+    if (c->fd[i] >= 0) close(c->fd[i]);
+  }
+#endif
+  (void) c;
+}
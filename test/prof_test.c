@@ -0,0 +1,152 @@
+// Copyright (c) 2022 Cesanta Software Limited
+// All rights reserved
+
+// Profiler tests. They live apart from unit_test.c, which tests ant3_eval()
+// and ant3_eval2() as they are built by default, without the profiler
+
+#define ANT3_PROFILE 1  // Build the profiler into ant3_eval() and ant3_eval2()
+#if defined(__unix__) || defined(__APPLE__)
+#define ANT3_SAMPLE 1  // Let a SIGPROF timer sample ant3_eval()
+#endif
+#include "../ant.h"
+
+// Both evaluators count the same instructions, sequences and offsets
+static void test_ant3_prof(void) {
+  static struct ant3_prof p, p2;
+  static unsigned long hits[64], hits2[64];
+  const char *src = "a=0; i=0; # a += i; i += 1; @b i<10; a";
+  struct ant3 vm;
+  unsigned long total = 0, pairs = 0, triples = 0;
+  uint8_t code[64];
+  size_t len, i;
+  int a, b;
+  memset(&vm, 0, sizeof(vm));
+  len = ant_compile(src, code, sizeof(code), &vm);
+  if (len == 0 || len > sizeof(hits) / sizeof(hits[0])) exit(1);
+  ant3_prof_init(&p, hits, len), ant3_prof_init(&p2, hits2, len);
+  vm.prof = &p;
+  if (ant3_eval(&vm, code) != 45) exit(1);
+  vm.prof = &p2;
+  if (ant3_eval2(&vm, code) != 45) exit(1);
+  if (memcmp(hits, hits2, sizeof(hits)) != 0 ||
+      memcmp(p.ops, p2.ops, sizeof(p.ops)) != 0 ||
+      memcmp(p.pairs, p2.pairs, sizeof(p.pairs)) != 0 ||
+      memcmp(p.keys, p2.keys, sizeof(p.keys)) != 0 ||
+      memcmp(p.triples, p2.triples, sizeof(p.triples)) != 0) {
+    exit(1);
+  }
+  for (i = 0; i < len; i++) total += hits[i];
+  for (a = 0; a < ANT3_OPS; a++) {
+    for (b = 0; b < ANT3_OPS; b++) pairs += p.pairs[a][b];
+  }
+  for (i = 0; i < ANT3_TRIPLES; i++) triples += p.triples[i];
+  if (hits[0] != 1 || hits[len - 1] != 1 || p.ops[Done] != 1 ||
+      p.ops[JumpS] != 10 || total < 50 || pairs != total - 1 ||
+      triples + p.lost != total - 2) {
+    exit(1);
+  }
+  ant3_prof_dump(&p, code, 5, stdout);
+  // A second run counts on, with n-grams not crossing the runs
+  vm.prof = &p;
+  ant3_eval(&vm, code);
+  if (hits[0] != 2 || p.ops[JumpS] != 20 || p.pairs[0][0] != 0) exit(1);
+}
+
+// Count executed instructions of `code` per line of `src`
+static void count_lines(const char *src, const uint8_t *code, size_t len,
+                        const struct ant3_map *map, struct ant3 *vm,
+                        unsigned long *lines, size_t nlines) {
+  static struct ant3_prof p;
+  static unsigned long hits[128];
+  if (len > sizeof(hits) / sizeof(hits[0])) exit(1);
+  ant3_prof_init(&p, hits, len);
+  vm->prof = &p;
+  ant3_eval(vm, code);
+  vm->prof = NULL;
+  ant3_map_lines(map, src, code, hits, len, lines, nlines);
+  ant3_lines_dump(src, lines, nlines, 10, stdout);
+}
+
+// Compilers map code to the statements it came from
+static void test_ant3_map(void) {
+  const char *src = "a = 0; i = 0;\n# a += i;\ni += 1;\n@b i < 10;\na";
+  const char *src2 = "0=a 0=i\n# ai+=a\nIi\ni 10 < @b\na";
+  const char *src3 = "fn sq(x) { x * x }\ns = sq(3);\ns";
+  struct ant3 vm;
+  uint8_t buf[64], code[128];
+  struct ant3_map map = {buf, sizeof(buf), 0, 0, 0};
+  unsigned long lines[6];
+  size_t len;
+  memset(&vm, 0, sizeof(vm));
+  len = ant_compile_map(src, code, sizeof(code), &vm, &map);
+  if (len == 0 || map.len > 20 || ant3_map_find(&map, code, 0) != 0 ||
+      ant3_map_find(&map, code, len - 1) != strlen(src) - 1) {
+    exit(1);
+  }
+  count_lines(src, code, len, &map, &vm, lines, 6);
+  if (lines[0] == 0 || lines[0] >= 10 || lines[1] == 0 || lines[1] % 10 ||
+      lines[2] == 0 || lines[2] % 10 || lines[3] == 0 || lines[3] % 10 ||
+      lines[4] == 0 || lines[4] >= 10 || lines[5] != 0) {
+    exit(1);
+  }
+  // Postfix source
+  memset(&vm, 0, sizeof(vm));
+  map.len = map.pc = map.src = 0;
+  len = ant2_compile_map(src2, code, sizeof(code), &vm, &map);
+  if (len == 0 || ant3_map_find(&map, code, len - 1) != strlen(src2) - 1) {
+    exit(1);
+  }
+  count_lines(src2, code, len, &map, &vm, lines, 6);
+  if (lines[0] == 0 || lines[0] >= 10 || lines[1] == 0 || lines[1] % 10 ||
+      lines[2] == 0 || lines[2] % 10 || lines[3] == 0 || lines[3] % 10 ||
+      lines[4] == 0 || lines[4] >= 10 || lines[5] != 0) {
+    exit(1);
+  }
+  // An inlined function leaves no statements behind
+  memset(&vm, 0, sizeof(vm));
+  map.len = map.pc = map.src = 0;
+  len = ant_compile_map(src3, code, sizeof(code), &vm, &map);
+  if (len == 0 || ant3_map_find(&map, code, 0) != 19 ||
+      ant3_map_find(&map, code, len - 1) != strlen(src3) - 1) {
+    exit(1);
+  }
+  // The map does not fit
+  map.len = map.pc = map.src = 0, map.size = 4;
+  if (ant_compile_map(src, code, sizeof(code), &vm, &map) != 0) exit(1);
+  if (ant2_compile_map(src2, code, sizeof(code), &vm, &map) != 0) exit(1);
+#if ANT3_SAMPLE
+  {
+    const char *loop = "a = 0; i = 0;\n# a += i;\ni += 1;\n@b i < 100000;\na";
+    static unsigned long hits[128];
+    unsigned long n = 0;
+    struct sigaction sa;
+    int k;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;  // Restored by ant3_sample_stop()
+    sigaction(SIGPROF, &sa, NULL);
+    map.len = map.pc = map.src = 0, map.size = sizeof(buf);
+    memset(&vm, 0, sizeof(vm));
+    len = ant_compile_map(loop, code, sizeof(code), &vm, &map);
+    if (len == 0 || !ant3_sample_start(code, hits, len, 1000)) exit(1);
+    for (k = 0; k < 5000 && n < 20; k++) {
+      size_t i;
+      ant3_eval(&vm, code);
+      for (n = 0, i = 0; i < len; i++) n += hits[i];
+    }
+    ant3_sample_stop();
+    if (sigaction(SIGPROF, NULL, &sa) != 0 || sa.sa_handler != SIG_IGN) {
+      exit(1);
+    }
+    signal(SIGPROF, SIG_DFL);
+    ant3_map_lines(&map, loop, code, hits, len, lines, 6);
+    ant3_lines_dump(loop, lines, 6, 10, stdout);
+    if (n < 20 || lines[1] + lines[2] + lines[3] < n / 2) exit(1);
+  }
+#endif
+}
+
+int main(void) {
+  test_ant3_prof();
+  test_ant3_map();
+  return 0;
+}
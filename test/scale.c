@@ -0,0 +1,212 @@
+// Copyright (c) 2022 Cesanta Software Limited
+// All rights reserved
+//
+// Scaling benchmark. Generates programs of growing size with gen.h and
+// reports, for every size, the run time of each engine per loop iteration
+// and the compile time of each compiler. All engines must return the same
+// result. Interpreters that scan the source for labels show it as a
+// per-iteration cost that grows with the loop body: ant2 always scans, ant
+// scans when built with -DANT_JUMPS=0. The opt column runs ant3 bytecode
+// after ant3_optimize(), and its compile time is that of the optimizer.
+//
+// Usage: ./scale [-s MAXSIZE] [-d DEPTH] [-v VARS] [-c COUNT] [-r RUNS] [-j]
+//   -s  largest infix source size in bytes, sizes double from 256, default
+//       16384
+//   -d  loop nesting depth, default 1
+//   -v  number of variables, default 8
+//   -c  iterations of each loop level, default 100
+//   -r  number of timed runs, the median is reported, default 5
+//   -j  print JSON instead of a table
+
+#include "perf.h"
+#include "gen.h"
+
+#define MAXSIZE 32768  // Largest source, keeps jumps within JumpL reach
+
+static char s_infix[MAXSIZE + 512], s_postfix[MAXSIZE + 512];
+static uint8_t s_code[MAXSIZE], s_codec[MAXSIZE], s_code2c[MAXSIZE];
+static uint8_t s_codeo[MAXSIZE];
+static antval_t s_mem4[MAXSIZE];
+static struct ant3 s_vmc, s_vm2c, s_vmo;
+static struct ant4 *s_ant4;
+
+static long exec_ant(void) {
+  static struct ant ant = ANT_INITIALIZER;
+  return ant_eval(&ant, s_infix);
+}
+
+static long exec_ant2(void) {
+  static struct ant2 ant = ANT2_INITIALIZER;
+  return ant2_eval(&ant, s_postfix);
+}
+
+static long exec_ant3(void) {
+  static struct ant3 vm;
+  return ant3_eval2(&vm, s_code);
+}
+
+static long exec_antc(void) {
+  return ant3_eval2(&s_vmc, s_codec);
+}
+
+static long exec_ant2c(void) {
+  return ant3_eval2(&s_vm2c, s_code2c);
+}
+
+static long exec_opt(void) {
+  return ant3_eval2(&s_vmo, s_codeo);
+}
+
+static long exec_ant4(void) {
+  return ant4_exec(s_ant4);
+}
+
+static long compile_antc(void) {
+  return (long) ant_compile(s_infix, s_codec, sizeof(s_codec), &s_vmc);
+}
+
+static long compile_ant2c(void) {
+  return (long) ant2_compile(s_postfix, s_code2c, sizeof(s_code2c), &s_vm2c);
+}
+
+static long compile_opt(void) {
+  memset(&s_vmo, 0, sizeof(s_vmo));
+  return (long) ant3_optimize(&s_vmo, s_code, s_codeo, sizeof(s_codeo), NULL);
+}
+
+static long compile_ant4(void) {
+  s_ant4 = ant4_create(s_mem4, sizeof(s_mem4));
+  return (long) ant4_compile(s_ant4, s_infix);
+}
+
+struct task {
+  const char *name;  // Column name
+  long (*fn)(void);  // Run or compile
+};
+
+static const struct task s_runs[] = {
+    {"ant", exec_ant},   {"ant2", exec_ant2},   {"ant3", exec_ant3},
+    {"antc", exec_antc}, {"ant2c", exec_ant2c}, {"opt", exec_opt},
+    {"ant4", exec_ant4}};
+static const struct task s_compiles[] = {{"antc", compile_antc},
+                                         {"ant2c", compile_ant2c},
+                                         {"opt", compile_opt},
+                                         {"ant4", compile_ant4}};
+#define NRUNS (sizeof(s_runs) / sizeof(s_runs[0]))
+#define NCOMPILES (sizeof(s_compiles) / sizeof(s_compiles[0]))
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+// Return median nanoseconds per call of `fn` over `runs` runs
+static double measure(long (*fn)(void), int runs) {
+  double t[32], start = now_ns();
+  long i, calls;
+  int k;
+  fn();
+  calls = (long) (5e6 / (now_ns() - start + 1)) + 1;  // About 5 ms per run
+  for (k = 0; k < runs; k++) {
+    start = now_ns();
+    for (i = 0; i < calls; i++) fn();
+    t[k] = (now_ns() - start) / (double) calls;
+  }
+  qsort(t, (size_t) runs, sizeof(t[0]), cmp_double);
+  return t[runs / 2];
+}
+
+int main(int argc, char *argv[]) {
+  struct gen g = {1, 0, 1, 8, 100};
+  struct gen_out o = {s_infix,         s_postfix, s_code, sizeof(s_infix),
+                      sizeof(s_postfix), sizeof(s_code), 0, 0, 0, 0, 0};
+  size_t size, maxsize = 16384;
+  int i, j, runs = 5, json = 0;
+  double iters;
+  for (i = 1; i < argc; i++) {
+    const char *v = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strcmp(argv[i], "-j") == 0) {
+      json = 1;
+    } else if (v != NULL && strcmp(argv[i], "-s") == 0) {
+      maxsize = (size_t) atol(v), i++;
+    } else if (v != NULL && strcmp(argv[i], "-d") == 0) {
+      g.depth = atoi(v), i++;
+    } else if (v != NULL && strcmp(argv[i], "-v") == 0) {
+      g.nvars = atoi(v), i++;
+    } else if (v != NULL && strcmp(argv[i], "-c") == 0) {
+      g.count = atoi(v), i++;
+    } else if (v != NULL && strcmp(argv[i], "-r") == 0) {
+      runs = atoi(v), i++;
+    } else {
+      break;
+    }
+  }
+  if (i < argc || maxsize > MAXSIZE || runs < 1 || runs > 32) {
+    fprintf(stderr,
+            "usage: %s [-s MAXSIZE] [-d DEPTH] [-v VARS] [-c COUNT] "
+            "[-r RUNS] [-j]\n",
+            argv[0]);
+    return 1;
+  }
+  for (iters = 1, i = 0; i < g.depth; i++) iters *= g.count;
+  if (json) {
+    printf("{\"depth\": %d, \"vars\": %d, \"count\": %d, \"sizes\": [",
+           g.depth, g.nvars, g.count);
+  } else {
+    printf("ns per iteration\n%-7s %5s %6s |", "size", "stmts", "code");
+    for (j = 0; j < (int) NRUNS; j++) printf(" %7s", s_runs[j].name);
+    printf(" | compile us");
+    for (j = 0; j < (int) NCOMPILES; j++) printf(" %6s", s_compiles[j].name);
+    printf("\n");
+  }
+  for (size = 256; size <= maxsize; size *= 2) {
+    double run[NRUNS], comp[NCOMPILES];
+    long expected;
+    g.size = size;
+    if (!gen_program(&g, &o)) {
+      fprintf(stderr, "cannot generate %lu bytes\n", (unsigned long) size);
+      return 1;
+    }
+    expected = exec_ant3();
+    for (j = 0; j < (int) NCOMPILES; j++) {
+      if (s_compiles[j].fn() == 0) {
+        fprintf(stderr, "%s: cannot compile %lu bytes\n", s_compiles[j].name,
+                (unsigned long) size);
+        return 1;
+      }
+      comp[j] = measure(s_compiles[j].fn, runs) / 1000;
+    }
+    for (j = 0; j < (int) NRUNS; j++) {
+      if (s_runs[j].fn() != expected) {
+        fprintf(stderr, "%s: result %ld, expected %ld, seed %u size %lu\n",
+                s_runs[j].name, s_runs[j].fn(), expected, g.seed,
+                (unsigned long) size);
+        return 1;
+      }
+      run[j] = measure(s_runs[j].fn, runs) / iters;
+    }
+    if (json) {
+      printf("%s\n  {\"size\": %lu, \"stmts\": %lu, \"code\": %lu, "
+             "\"ns_per_iter\": {",
+             size == 256 ? "" : ",", (unsigned long) o.ilen,
+             (unsigned long) o.stmts, (unsigned long) o.clen);
+      for (j = 0; j < (int) NRUNS; j++) {
+        printf("%s\"%s\": %.1f", j ? ", " : "", s_runs[j].name, run[j]);
+      }
+      printf("}, \"compile_us\": {");
+      for (j = 0; j < (int) NCOMPILES; j++) {
+        printf("%s\"%s\": %.2f", j ? ", " : "", s_compiles[j].name, comp[j]);
+      }
+      printf("}}");
+    } else {
+      printf("%-7lu %5lu %6lu |", (unsigned long) o.ilen,
+             (unsigned long) o.stmts, (unsigned long) o.clen);
+      for (j = 0; j < (int) NRUNS; j++) printf(" %7.0f", run[j]);
+      printf(" |           ");
+      for (j = 0; j < (int) NCOMPILES; j++) printf(" %6.1f", comp[j]);
+      printf("\n");
+    }
+  }
+  if (json) printf("\n]}\n");
+  return 0;
+}
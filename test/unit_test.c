@@ -2,7 +2,10 @@
 // All rights reserved
 
 #include <assert.h>
+#include <ctype.h>
+#include <limits.h>
 #include "../ant.h"
+#include "gen.h"
 
 static void check(struct ant *ant, const char *buf, antval_t expected,
                   const char *errstr) {
@@ -38,6 +41,17 @@ static void test_ant(void) {
   check(&ant, "a = 1; b = 2; a < b", 1, "");
   check(&ant, "a = 1; b = 2; a > b", 0, "");
   check(&ant, "a=0; i=0; # a += i; i += 1; @b i<10; a", 45, "");
+  check(&ant, "a = 1; @f a; a = 7; # a", 1, "");
+  check(&ant, "a = 0; @f a; a = 7; # a", 7, "");
+  check(&ant, "a = 1; @f a; a = 7; # @f 1; a = 8", 1, "");
+  check(&ant, "a", 1, "");
+  check(&ant, "a = 1; @b 0; @f 0; @f 0; @f 0; @f 0; @f 0; @f 0; @f 0; "
+              "i=0; # a += i; i += 1; @b i<10; a", 46, "");
+  check(&ant, "i = 0; a = 0; # i += 1; @f i > 5; a += i; @b 1; # @f 0; a",
+        15, "");
+  check(&ant, "a = 1; @f a; a = 7; #", 1, "");
+  check(&ant, "a = 3; @f 0", 3, "");
+  check(&ant, "i = 0; # i += 1; @b i < 4", 4, "");
 }
 
 static void check2(struct ant2 *ant, const char *buf, antval_t expected) {
@@ -63,68 +77,929 @@ static void test_ant2(void) {
   check2(&ant, "0=a 0=i 1000=d  # ai+i3/+=a Ii id< @b a", 665667);
 }
 
+static void check5(struct ant3 *ant, const unsigned char *pc, antval_t exp) {
+  struct ant5 ant5;
+  struct ant5_insn code[256];
+  size_t i, n;
+  antval_t res;
+  int funcs = 0;
+  for (i = 0; pc[i] != Done; i += ant3_oplen(&pc[i])) funcs |= pc[i] == Func;
+  if (i >= 256 || funcs) return;  // ant5 has no calls, and up to 256 bytes
+  n = ant5_compile(&ant5, ant, pc, code, 256);
+  res = ant5_eval(&ant5, code);
+  printf("  ant5: %d insns, %ld %ld\n", (int) n, res, exp);
+  if (n == 0 || res != exp) exit(1);
+}
+
+static void checkjit(struct ant3 *ant, const unsigned char *pc, antval_t exp) {
+  struct ant3 saved = *ant, saved2 = *ant;
+  ant3_jit_t fn = ant3_jit(pc);
+  antval_t res = fn == NULL ? ant3_eval2(&saved, pc) : fn(&saved);
+  ant3_eval(&saved2, pc);
+  printf("  jit: %s, %ld %ld %d\n", fn ? "yes" : "no", res, exp, saved.sp);
+  if (res != exp || saved.sp != saved2.sp) exit(1);
+  if (memcmp(saved.vars, saved2.vars, sizeof(saved.vars)) != 0) exit(1);
+  ant3_jit_free(fn);
+}
+
 static void check3(struct ant3 *ant, const unsigned char *pc, antval_t exp) {
-  struct ant3 saved = *ant;
+  struct ant3 saved = *ant, fusedvm, optimized;
+  unsigned char fused[4096], opt[8192];
+  size_t n, removed;
+#if defined(__GNUC__) || defined(__clang__)
+  union ant3_cell cells[4096];
+#endif
   antval_t res = ant3_eval(&saved, pc);
   printf(" ANT3 check...\n  %ld %ld %d\n", res, exp, saved.sp);
   if (res != exp) exit(1);
+  if (ant3_verify(pc, 4096, ant->fns) < 0) exit(1);
 #if defined(__GNUC__) || defined(__clang__)
   saved = *ant;
   res = ant3_eval2(&saved, pc);
   printf("  %ld %ld %d\n", res, exp, saved.sp);
   if (res != exp) exit(1);
+  saved = *ant;
+  res = ant3_eval_tos(&saved, pc);
+  printf("  tos: %ld %ld %d\n", res, exp, saved.sp);
+  if (res != exp) exit(1);
+  saved = *ant;
+  n = ant3_link(pc, cells, sizeof(cells) / sizeof(cells[0]));
+  res = ant3_eval_linked(&saved, cells);
+  printf("  linked: %d cells, %ld %ld %d\n", (int) n, res, exp, saved.sp);
+  if (n == 0 || res != exp) exit(1);
+  if (ant3_link(pc, cells, 1) != 0 && pc[0] != Done) exit(1);
 #endif
+  saved = *ant;
+  res = ant3_eval_tail(&saved, pc);
+  printf("  tail: %ld %ld %d\n", res, exp, saved.sp);
+  if (res != exp) exit(1);
+  fusedvm = *ant;
+  n = ant3_fuse(&fusedvm, pc, fused, sizeof(fused));
+  saved = fusedvm;
+  res = ant3_eval(&saved, fused);
+  printf("  fused: %d bytes, %ld %ld %d\n", (int) n, res, exp, saved.sp);
+  if (n == 0 || res != exp || ant3_verify(fused, n, ant->fns) < 0) {
+    exit(1);
+  }
+  optimized = *ant;
+  n = ant3_optimize(&optimized, pc, opt, sizeof(opt), &removed);
+  saved = optimized;
+  res = ant3_eval(&saved, opt);
+  printf("  optimized: %d bytes, %d removed, %ld %ld %d\n", (int) n,
+         (int) removed, res, exp, saved.sp);
+  if (n == 0 || res != exp || ant3_verify(opt, n, ant->fns) < 0) exit(1);
+  check5(ant, pc, exp);
+  check5(&fusedvm, fused, exp);
+  check5(&optimized, opt, exp);
+  checkjit(ant, pc, exp);
+  checkjit(&fusedvm, fused, exp);
+  checkjit(&optimized, opt, exp);
+}
+
+static void check2c(const char *buf, antval_t expected) {
+  struct ant2 ant = ANT2_INITIALIZER;
+  struct ant3 vm = {{0}, {0}, {0}, 0, 0};
+  unsigned char code[256];
+  size_t n = ant2_compile(buf, code, sizeof(code), &vm);
+  antval_t res = ant2_eval(&ant, buf);
+  printf("[%s] \t=> %d bytes, %ld %ld\n", buf, (int) n, res, expected);
+  if (n == 0 || res != expected) exit(1);
+  check3(&vm, code, expected);
+}
+
+static void test_ant2_compile(void) {
+  unsigned char code[256];
+  struct ant3 vm = {{0}, {0}, {0}, 0, 0};
+  check2c("1", 1);
+  check2c("1 2 +", 3);
+  check2c("0x10 010 +", 24);
+  check2c("7 =a 3 =b a", 7);
+  check2c("1 2 <", 1);
+  check2c("2 1 <", 0);
+  check2c("2 1 >", 1);
+  check2c("1 1 ; 2 *", 2);
+  check2c("1 =a 1 @f 7 =a # a", 1);
+  check2c("1 =a 0 @f 7 =a # a", 7);
+  check2c("# 0 @b 1", 1);
+  check2c("0 =a 0 =i # a i + =a 1 i + =i i 10 < @b a", 45);
+  check2c("0 =a 0 =i # a i + =a Ii i 10 < @b a", 45);
+  check2c("0=a 0=i 1000=d  # ai+i3/+=a Ii id< @b a", 665667);
+  check2c("1 2", 1);
+  check2c("5 =a", 5);
+  check2c("5 =a 7 =b", 7);
+  check2c("1 2 ; 3 =a", 1);
+  check2c("1 =a # a 0 @f 9 ;", 1);
+  check2c("0 =i # Ii i 3 < @b", 0);
+  check2c("0 =i # Ii i 3 < @b 7 =a", 7);
+  if (ant2_compile("1 =", code, sizeof(code), &vm) != 0) exit(1);
+  if (ant2_compile("1 2 3 4 5 6 7 8 9 10 11", code, 256, &vm) != 0) exit(1);
 }
 
 static void test_ant3(void) {
   {
-    struct ant3 ant = {{3, 1000}, {0}, {0}, 0};
+    struct ant3 ant = {{3, 1000}, {0}, {0}, 0, 0};
     unsigned char code[] = {IncVar, 0, PushVar, 0, Done};
     check3(&ant, code, 1);
   }
   {
-    struct ant3 ant = {{3, 1000}, {0}, {0}, 0};
+    struct ant3 ant = {{3, 1000}, {0}, {0}, 0, 0};
     unsigned char code[] = {PushImm, 0, Done};
     check3(&ant, code, 3);
   }
   {
-    struct ant3 ant = {{3, 1000}, {0}, {0}, 0};
+    struct ant3 ant = {{3, 1000}, {0}, {0}, 0, 0};
     unsigned char code[] = {IncVar, 1, PushVar, 1, PopVar,  0, CmpVarImm,
                             1,      1, Jump,    0, PushVar, 0, Done};
     check3(&ant, code, 1000);
   }
   {
-    struct ant3 ant = {{3, 1000}, {0}, {0}, 0};
+    struct ant3 ant = {{3, 1000}, {0}, {0}, 0, 0};
     unsigned char code[] = {PushVar, 0,       PushVar, 1,         Plus, PushVar,
                             1,       PushImm, 0,       Div,       Plus, PopVar,
                             0,       IncVar,  1,       CmpVarImm, 1,    1,
                             Jump,    0,       PushVar, 0,         Done};
     check3(&ant, code, 665667);
   }
+  {
+    // Done with an empty stack returns 0 in every engine
+    struct ant3 ant = {{0}, {0}, {42}, 0, 0};
+    unsigned char code[] = {PushI8, 5, PopVar, 0, Done};
+    check3(&ant, code, 0);
+  }
+#if defined(__GNUC__) || defined(__clang__)
+  {
+    // Done with an empty stack returns 0 and leaves the stack alone
+    struct ant3 ant = {{0}, {0}, {42}, 0, 0};
+    unsigned char code[] = {PushI8, 5, PopVar, 0, Done};
+    if (ant3_eval_tos(&ant, code) != 0 || ant.sp != 0) exit(1);
+    if (ant.vars[0] != 5 || ant.stack[0] != 42) exit(1);
+  }
+  {
+    struct ant3 ant = {{0}, {0}, {42}, 0, 0};
+    unsigned char code[] = {PushI8, 5, PopVar, 0, Done};
+    union ant3_cell cells[8];
+    if (ant3_link(code, cells, 8) == 0) exit(1);
+    if (ant3_eval_linked(&ant, cells) != 0 || ant.sp != 0) exit(1);
+    if (ant.vars[0] != 5 || ant.stack[0] != 42) exit(1);
+  }
+#endif
+}
+
+static void checkc(const char *buf, antval_t expected) {
+  struct ant ant = ANT_INITIALIZER;
+  struct ant3 vm = {{0}, {0}, {0}, 0, 0};
+  unsigned char code[4096];
+  size_t n = ant_compile(buf, code, sizeof(code), &vm);
+  antval_t res = ant_eval(&ant, buf);
+  printf("[%s] \t=> %d bytes, %ld %ld\n", buf, (int) n, res, expected);
+  if (n == 0 || res != expected) exit(1);
+  check3(&vm, code, expected);
+}
+
+static void test_ant_compile(void) {
+  unsigned char code[10];
+  struct ant3 vm = {{0}, {0}, {0}, 0, 0};
+  checkc("", 0);
+  checkc("1", 1);
+  checkc("1 + 2", 3);
+  checkc("1 - 2", -1);
+  checkc("1 - 2 + 3", -4);
+  checkc("6/2", 3);
+  checkc("1 + 2 * 3", 7);
+  checkc("(1 + 2) * 3", 9);
+  checkc("(6 / (1 + 1)) * 3", 9);
+  checkc("a + 1", 1);
+  checkc("1;2", 2);
+  checkc("a = 7; a + 1", 8);
+  checkc("b = c = 17; b + c", 34);
+  checkc("b = 17; c = 1; b -= c", 16);
+  checkc("b = 17; c = 1; c += b", 18);
+  checkc("a = 1; b = 2; a == b", 0);
+  checkc("a = 1; b = 2; a == 1", 1);
+  checkc("a = 1; b = 2; a < b", 1);
+  checkc("a = 1; b = 2; a > b", 0);
+  checkc("a = 1; @f a; a = 7; # a", 1);
+  checkc("a = 1; @f a == 0; a = 7; # a", 7);
+  checkc("a=0; i=0; # a += i; i += 1; @b i<10; a", 45);
+  checkc("a=0; i=0; b=1; c=1000; # a += i+i/3; i += b; @b i<c; a", 665667);
+  checkc("a = 1; @f a; a = 7; #", 1);
+  checkc("a = 1; @f a; a = 7; # @f 1; a = 8", 1);
+  checkc("a = 5; #", 5);
+  checkc("a = 3; @f 0", 3);
+  checkc("@f 0; #", 0);
+  checkc("i = 0; # i += 1; @b i < 4", 4);
+  checkc("i = 0; # @f i > 2; i += 1; @b 1; #", 3);
+  checkc("a = 1; @f 0; @f 0; @f 0; @f 0; @f 0; @f 0; @f 0; @f 0; @f 0; # a", 1);
+  checkc("a = 1; @f a; @f a; @f a; @f a; @f a; @f a; @f a; @f a; @f a; # a", 1);
+  if (ant_compile("1 +", code, sizeof(code), &vm) != 0) exit(1);
+  if (ant_compile("(1", code, sizeof(code), &vm) != 0) exit(1);
+  if (ant_compile("a=1;b=2;c=3;d=4", code, sizeof(code), &vm) != 0) exit(1);
+  if (ant_compile("z = 1", code, sizeof(code), &vm) != 7) exit(1);
+}
+
+static void test_ant_vars(void) {
+  const char *src = "total = 0; n_2 = 0; # total += n_2; n_2 += 1; "
+                    "@b n_2 < 10; total";
+  struct ant3 vm = {{0}, {0}, {0}, 0, 0};
+  unsigned char code[256];
+  char buf[200];
+  int i, n = 0;
+  if (ant_compile(src, code, sizeof(code), &vm) == 0) exit(1);
+  check3(&vm, code, 45);
+  if (ant_compile("z = 3; zz = 4; z * zz", code, sizeof(code), &vm) == 0)
+    exit(1);
+  check3(&vm, code, 12);
+  if (ant_var(src, "total") != 0 || ant_var(src, "n_2") != 1) exit(1);
+  if (ant_var(src, "n") != -1 || ant_var(src, "b") != -1) exit(1);
+  // Variables get slots in order of appearance, the host can preset them
+  if (ant_compile("x = x * 2 + y", code, sizeof(code), &vm) == 0) exit(1);
+  vm.vars[ant_var("x = x * 2 + y", "y")] = 5;
+  vm.vars[ant_var("x = x * 2 + y", "x")] = 7;
+  if (ant3_eval(&vm, code) != 19) exit(1);
+  // Too many variables
+  for (i = 0; i <= ANT3_VARS; i++) {
+    n += snprintf(buf + n, sizeof(buf) - (size_t) n, "v%d;", i);
+  }
+  if (ant_compile(buf, code, sizeof(code), &vm) != 0) exit(1);
+}
+
+static void test_ant3_pushi(void) {
+  struct ant3 vm = {{0}, {0}, {0}, 0, 0};
+  unsigned char code[256];
+  unsigned char pushi[] = {PushI8,  0x80, PushI16, 0x00, 0x80, PushI32, 0xff,
+                           0xff,    0xff, 0xff,    Plus, Plus, Done};
+  antval_t big = (antval_t) (sizeof(antval_t) > 4 ? 0x123456789UL : 1UL << 30);
+  char buf[300];
+  size_t n, i, count = 0;
+  check3(&vm, pushi, -128 - 32768 - 1);
+  if (ant3_pushi(code, 127) != 2 || code[0] != PushI8) exit(1);
+  if (ant3_pushi(code, -129) != 3 || code[0] != PushI16) exit(1);
+  if (ant3_pushi(code, 32768) != 5 || code[0] != PushI32) exit(1);
+  if (ant3_int(&pushi[3], 2) != -32768 || ant3_int(&pushi[6], 4) != -1) exit(1);
+  // More than 10 distinct constants
+  checkc("a=1+2; a=a+3+4+5+6; a=a+7+8+9+10; a=a+11+300+70000", 70366);
+  // Large constants are deduplicated in the pool
+  snprintf(buf, sizeof(buf), "%lu + %lu", (unsigned long) big,
+           (unsigned long) big);
+  checkc(buf, big + big);
+  n = ant_compile(buf, code, sizeof(code), &vm);
+  if (sizeof(antval_t) > 4 && (n != 6 || vm.imm[0] != big || vm.imm[1] != 0))
+    exit(1);
+  // When the pool is full, large constants are inlined
+  for (i = 0, n = 0; i < 12; i++) {
+    n += (size_t) snprintf(buf + n, sizeof(buf) - n, "a=%s%lu;",
+                           i ? "a+" : "", (unsigned long) (big + (antval_t) i));
+  }
+  strcat(buf, "a");
+  checkc(buf, big * 12 + 66);
+  n = ant_compile(buf, code, sizeof(code), &vm);
+  for (i = 0; i < n; i += ant3_oplen(&code[i])) count += code[i] == PushI64;
+  if (sizeof(antval_t) > 4 && count != 2) exit(1);
+}
+
+static antval_t emitted;
+
+static antval_t fn_answer(void) {
+  return 42;
+}
+
+static antval_t fn_emit(antval_t a) {
+  return emitted = a;
+}
+
+static antval_t fn_sub(antval_t a, antval_t b) {
+  return a - b;
+}
+
+static antval_t fn_digits(antval_t a, antval_t b, antval_t c, antval_t d) {
+  return a * 1000 + b * 100 + c * 10 + d;
+}
+
+static antval_t fn_sum(const antval_t *args, int nargs) {
+  antval_t sum = 0;
+  while (nargs-- > 0) sum += args[nargs];
+  return sum;
+}
+
+static const struct ant3_fn fns[] = {
+    ANT3_FN("answer", fn_answer, 0), ANT3_FN("emit", fn_emit, 1),
+    ANT3_FN("sub", fn_sub, 2),       ANT3_FN("digits", fn_digits, 4),
+    ANT3_FN("sum", fn_sum, -1),      ANT3_FN(NULL, NULL, 0),
+};
+
+static void test_ant3_native(void) {
+  struct ant3 vm = {{0}, {0}, {0}, 0, fns};
+  unsigned char code[256];
+  unsigned char underflow[] = {PushI8, 1, CallNative, 1, 2, Done};
+  unsigned char emit1[] = {PushI8, 1, CallNative, 1, 1, Done};
+  unsigned char sum2[] = {PushI8, 1, PushI8, 2, CallNative, 4, 2, Done};
+  unsigned char bad_fn[] = {PushI8, 1, CallNative, 200, 1, Done};
+  unsigned char bad_nargs[] = {PushI8, 1, PushI8, 2, CallNative, 1, 2, Done};
+  if (ant_compile("answer() + sub(10, 3) * digits(1, 2, 3, 4)", code,
+                  sizeof(code), &vm) == 0) {
+    exit(1);
+  }
+  check3(&vm, code, 42 + 7 * 1234);
+  if (ant_compile("sum() + sum(1) + sum(1, 2, 3, 4, 5)", code, sizeof(code),
+                  &vm) == 0) {
+    exit(1);
+  }
+  check3(&vm, code, 16);
+  if (ant_compile("x = 5; emit(x); emit(x * 2); x", code, sizeof(code), &vm) ==
+      0) {
+    exit(1);
+  }
+  check3(&vm, code, 5);
+  if (emitted != 10) exit(1);
+  if (ant_compile("nope(1)", code, sizeof(code), &vm) != 0) exit(1);
+  if (ant_compile("answer(1)", code, sizeof(code), &vm) != 0) exit(1);
+  if (ant_compile("sub(1, 2", code, sizeof(code), &vm) != 0) exit(1);
+  if (ant_var("a = sum(b)", "sum") != -1 || ant_var("a = sum(b)", "b") != 1)
+    exit(1);
+  if (ant3_verify(underflow, sizeof(underflow), fns) != -1) exit(1);
+  // Function index and argument count are checked against the table
+  if (ant3_verify(emit1, sizeof(emit1), fns) != 1) exit(1);
+  if (ant3_verify(sum2, sizeof(sum2), fns) != 2) exit(1);
+  if (ant3_verify(emit1, sizeof(emit1), NULL) != -1) exit(1);
+  if (ant3_verify(bad_fn, sizeof(bad_fn), fns) != -1) exit(1);
+  if (ant3_verify(bad_nargs, sizeof(bad_nargs), fns) != -1) exit(1);
+  vm.fns = NULL;
+  if (ant_compile("answer()", code, sizeof(code), &vm) != 0) exit(1);
+}
+
+// Count instructions with opcode `op`
+static int count_ops(const unsigned char *code, int op) {
+  size_t i;
+  int n = 0;
+  for (i = 0; code[i] != Done; i += ant3_oplen(&code[i])) n += code[i] == op;
+  return n;
+}
+
+static void test_ant3_calls(void) {
+  struct ant3 vm = {{0}, {0}, {0}, 0, fns};
+  unsigned char code[1024];
+  unsigned char fn[] = {Func, 1, 8, 0, Pick, 1, Ret, 1,  // fn f(a) { a }
+                        PushI8, 5, Call, 0xfa, 0xff, 1, Done};
+  unsigned char recursive[] = {Func, 0, 10, 0, Call, 0, 0, 0, Ret, 0, Done};
+  unsigned char escape[] = {Func,   0, 12, 0,      PushI8, 1, JumpS,
+                            6,      PushI8, 0, Ret, 0, PushI8, 1, Done};
+  unsigned char unknown[] = {PushI8, 1, Call, 0xfe, 0xff, 1, Done};
+  unsigned char pick[] = {PushI8, 1, Pick, 2, Done};
+  char buf[1024];
+  size_t n;
+  int i;
+
+  // Short leaf functions are inlined, and cost no calls. Simple arguments
+  // are substituted, others are left on the stack and dropped with Nip
+  if (ant_compile("fn twice(a) { a * 2 } fn one() { 1 } twice(3) + "
+                  "twice(4 + x) + one()",
+                  code, sizeof(code), &vm) == 0) {
+    exit(1);
+  }
+  if (count_ops(code, Func) != 0 || count_ops(code, Pick) != 1 ||
+      count_ops(code, Nip) != 1) {
+    exit(1);
+  }
+  check3(&vm, code, 15);
+  // Function with a loop, calling an inlined one
+  if (ant_compile("fn sq(x) { x * x } "
+                  "fn sumsq(n) { s = 0; i = 0; # s += sq(i); i += 1; @b i < n; "
+                  "s } sumsq(4) + sumsq(3)",
+                  code, sizeof(code), &vm) == 0) {
+    exit(1);
+  }
+  if (count_ops(code, Func) != 1 || count_ops(code, Call) != 2) exit(1);
+  check3(&vm, code, 19);
+  // Nested calls, with arguments read from different stack depths
+  if (ant_compile("fn add3(a, b, c) { t = a + b; t = t + c; t } "
+                  "fn f(x) { add3(x, 1, 2) * add3(x, x, x) } "
+                  "fn g(a, b) { sub(a, b) * f(b) } "
+                  "g(5, 2) + f(3) + 10",
+                  code, sizeof(code), &vm) == 0) {
+    exit(1);
+  }
+  if (count_ops(code, Func) != 3) exit(1);
+  check3(&vm, code, 3 * 30 + 54 + 10);
+  // Calls nest up to ANT3_FRAMES deep
+  strcpy(buf, "fn f0(a) { t = a; t = t * 2; t = t + 1; t = t - 1; t } ");
+  n = strlen(buf);
+  for (i = 1; i < ANT3_FRAMES; i++) {
+    n += (size_t) snprintf(buf + n, sizeof(buf) - n,
+                           "fn f%d(a) { f%d(a) + 1 } ", i, i - 1);
+  }
+  snprintf(buf + n, sizeof(buf) - n, "f%d(5)", ANT3_FRAMES - 1);
+  if (ant_compile(buf, code, sizeof(code), &vm) == 0) exit(1);
+  check3(&vm, code, 10 + ANT3_FRAMES - 1);
+  snprintf(buf + n, sizeof(buf) - n, "fn g(a) { f%d(a) } g(5)",
+           ANT3_FRAMES - 1);
+  if (ant_compile(buf, code, sizeof(code), &vm) != 0) exit(1);
+
+  if (ant_compile("fn f(a) { f(a) } 1", code, sizeof(code), &vm) != 0 ||
+      ant_compile("fn f(a) { a } f(1, 2)", code, sizeof(code), &vm) != 0 ||
+      ant_compile("fn f(a) { a = 1 } 1", code, sizeof(code), &vm) != 0 ||
+      ant_compile("fn f() { fn g() { 1 } }", code, sizeof(code), &vm) != 0 ||
+      ant_compile("fn f(a) { @f a } 1", code, sizeof(code), &vm) != 0 ||
+      ant_compile("fn f(a { a }", code, sizeof(code), &vm) != 0 ||
+      ant_compile("1 }", code, sizeof(code), &vm) != 0) {
+    exit(1);
+  }
+  if (ant_var("fn f(a) { a + b } c = f(1)", "a") != -1 ||
+      ant_var("fn f(a) { a + b } c = f(1)", "b") != 0 ||
+      ant_var("fn f(a) { a + b } c = f(1)", "c") != 1 ||
+      ant_var("fn f(a) { a + b } c = f(1)", "f") != -1) {
+    exit(1);
+  }
+
+  check3(&vm, fn, 5);
+  if (ant3_verify(fn, sizeof(fn), NULL) != 2) exit(1);
+  if (ant3_verify(fn, 8, NULL) != -1 ||
+      ant3_verify(fn + 4, sizeof(fn) - 4, NULL) != -1 ||
+      ant3_verify(recursive, sizeof(recursive), NULL) != -1 ||
+      ant3_verify(escape, sizeof(escape), NULL) != -1 ||
+      ant3_verify(unknown, sizeof(unknown), NULL) != -1 ||
+      ant3_verify(pick, sizeof(pick), NULL) != -1) {
+    exit(1);
+  }
+}
+
+static void test_ant3_jumps(void) {
+  struct ant3 vm = {{0}, {0}, {0}, 0, 0};
+  unsigned char code[4096];
+  unsigned char longj[] = {PushImm, 0,       JumpL, 5,   0,
+                           IncVar,  0,       PushVar, 0, Done};
+  unsigned char shortj[] = {PushImm, 0, JumpS, 4, IncVar, 0, PushVar, 0, Done};
+  char buf[1000];
+  size_t i, n, nshort = 0, nlong = 0;
+  // Loop body is longer than 255 bytes
+  strcpy(buf, "a = 0; i = 0; # a += i; ");
+  for (i = 0; i < 40; i++) strcat(buf, "b += 1; ");
+  strcat(buf, "i += 1; @b i < 10; @f a > 0; a = 1; # a + b");
+  checkc(buf, 445);
+  n = ant_compile(buf, code, sizeof(code), &vm);
+  if (n < 256) exit(1);
+  for (i = 0; code[i] != Done; i += ant3_oplen(&code[i])) {
+    nlong += code[i] == JumpL, nshort += code[i] == JumpS;
+  }
+  if (nlong != 1 || nshort != 1) exit(1);
+  // Forward jump over more than 255 bytes of code
+  strcpy(buf, "@f 1; ");
+  for (i = 0; i < 40; i++) strcat(buf, "b += 1; ");
+  strcat(buf, "# b + 7");
+  checkc(buf, 7);
+  // Relaxation shrinks the jump and keeps it working
+  vm.imm[0] = 1;
+  memcpy(code, longj, sizeof(longj));
+  if (ant3_relax(code) != sizeof(shortj)) exit(1);
+  if (memcmp(code, shortj, sizeof(shortj)) != 0) exit(1);
+  check3(&vm, longj, 0);
+  check3(&vm, shortj, 0);
+  vm.imm[0] = 0;
+  check3(&vm, shortj, 1);
+  // Short jump can't reach far, rewriting fails rather than breaks the code
+  if (ant3_set_target(shortj, 2, 200) != 0) exit(1);
+  if (ant3_target(shortj, 2) != 6) exit(1);
+  if (ant3_set_target(longj, 2, 200) != 1) exit(1);
+  if (ant3_target(longj, 2) != 200) exit(1);
+}
+
+static void test_ant3_fuse(void) {
+  struct ant3 ant = {{3, 1000}, {0}, {0}, 0, 0};
+  unsigned char code[] = {PushVar, 0,       PushVar, 1,         Plus, PushVar,
+                          1,       PushImm, 0,       Div,       Plus, PopVar,
+                          0,       IncVar,  1,       CmpVarImm, 1,    1,
+                          Jump,    0,       PushVar, 0,         Done};
+  unsigned char fused[] = {AddVarVar, 0, 1, DivVarImm,    1, 0, Plus,
+                           PopVar,    0, IncVar,          1, JumpVarNeImm,
+                           1,         1, 0xf5, 0xff,   PushVar, 0, Done};
+  // Jump into the middle of a sequence prevents fusion
+  unsigned char nofuse[] = {PushVar, 0, PushVar, 1,       Plus, PopVar, 0,
+                            PushImm, 0, Jump,    4,       PushVar, 0, Done};
+  unsigned char accum[] = {PushVar, 0,      PushVar, 1, PushImm, 0,   Div,
+                           Plus,    PopVar, 0,       PushVar, 0,    Done};
+  unsigned char accum2[] = {DivVarImm, 1, 0, AccumVar, 0, PushVar, 0, Done};
+  unsigned char out[100];
+  size_t n = ant3_fuse(&ant, code, out, sizeof(out));
+  if (n != sizeof(fused) || memcmp(out, fused, n) != 0) exit(1);
+  if (ant3_fuse(&ant, code, out, 10) != 0) exit(1);
+  n = ant3_fuse(&ant, nofuse, out, sizeof(out));
+  if (n != sizeof(nofuse) || memcmp(out, nofuse, n) != 0) exit(1);
+  n = ant3_fuse(&ant, accum, out, sizeof(out));
+  if (n != sizeof(accum2) || memcmp(out, accum2, n) != 0) exit(1);
+}
+
+static void test_ant3_optimize(void) {
+  struct ant3 vm = {{0}, {0}, {0}, 0, 0};
+  unsigned char code[256], out[256];
+  // Dead store is removed, PushImm + PopVar becomes Assign
+  unsigned char stores[] = {PushImm, 0, PopVar, 0, PushImm, 1,
+                            PopVar,  0, PushVar, 0, Done};
+  unsigned char stores2[] = {Assign, 0, 1, PushVar, 0, Done};
+  // Jump to an unconditional jump is threaded
+  unsigned char jumps[] = {PushVar, 0,      Jump, 8,      PushImm, 1,
+                           PopVar,  1,      PushImm, 0,   Jump,    14,
+                           IncVar,  1,      PushVar, 1,   Done};
+  unsigned char jumps2[] = {PushVar, 0,       Jump, 13,     Assign, 1,
+                            1,       PushImm, 0,    Jump,   13,     IncVar,
+                            1,       PushVar, 1,    Done};
+  unsigned char div0[] = {PushImm, 0, PushImm, 0, Div, Done};
+  unsigned char far_imm[] = {PushImm, 40, PushImm, 200, PushImm, 3, Done};
+  unsigned char fold[] = {PushI8, 1,      PushI8, 2,       Plus, JumpS,
+                          4,      IncVar, 1,      PushVar, 1,    Done};
+  unsigned char thread[] = {PushVar, 0,      JumpS,  4,     IncVar,
+                            1,       PushI8, 1,      JumpS, 4,
+                            IncVar,  1,      PushVar, 1,    Done};
+  size_t n, removed;
+  n = ant_compile("1 + 2 * 3", code, sizeof(code), &vm);
+  n = ant3_optimize(&vm, code, out, sizeof(out), &removed);
+  if (n != 3 || out[0] != PushI8 || out[1] != 7) exit(1);
+  if (removed != 4) exit(1);
+  if (ant3_optimize(&vm, code, out, 2, NULL) != 0) exit(1);
+  // Room for the result is enough, all passes still run
+  if (ant3_optimize(&vm, code, out, 4, NULL) != 3 || out[1] != 7) exit(1);
+  vm.imm[0] = 5, vm.imm[1] = 6;
+  n = ant3_optimize(&vm, stores, out, sizeof(out), &removed);
+  if (n != sizeof(stores2) || memcmp(out, stores2, n) != 0) exit(1);
+  if (removed != 3) exit(1);
+  vm.imm[0] = 1, vm.imm[1] = 7;
+  check3(&vm, jumps, 7);
+  n = ant3_optimize(&vm, jumps, out, sizeof(out), &removed);
+  if (n != sizeof(jumps2) || memcmp(out, jumps2, n) != 0) exit(1);
+  vm.imm[0] = 0;
+  n = ant3_optimize(&vm, div0, out, sizeof(out), &removed);
+  if (n != sizeof(div0) || memcmp(out, div0, n) != 0 || removed != 0) exit(1);
+  // Immediate indices past imm[] are not counted as used slots
+  if (ant3_used_imms(far_imm) != 8) exit(1);
+  // Short jumps past offset 127 are folded and threaded
+  for (n = 0; n < 140; n += 2) code[n] = IncVar, code[n + 1] = 0;
+  memcpy(&code[n], fold, sizeof(fold));
+  if (ant3_optimize(&vm, code, out, sizeof(out), &removed) != 149) exit(1);
+  if (removed != 2 || out[142] != JumpS || out[143] != 4) exit(1);
+  check3(&vm, code, 0);
+  memcpy(&code[n], thread, sizeof(thread));
+  if (ant3_optimize(&vm, code, out, sizeof(out), &removed) != 155) exit(1);
+  if (out[142] != JumpS || out[143] != 10) exit(1);
+  check3(&vm, code, 0);
+}
+
+static void test_ant3_divconst(void) {
+  struct ant3 ant = {{3, 1000}, {0}, {0}, 0, 0}, saved;
+  unsigned char code[] = {PushVar, 0,       PushVar, 1,         Plus, PushVar,
+                          1,       PushImm, 0,       Div,       Plus, PopVar,
+                          0,       IncVar,  1,       CmpVarImm, 1,    1,
+                          Jump,    0,       PushVar, 0,         Done};
+  antval_t ds[] = {2, 3, 5, 6, 7, 10, 641, 1000, -2, -3, -7, -1000, 1 << 20,
+                   LONG_MAX, LONG_MIN + 1, LONG_MAX / 3, LONG_MIN / 7};
+  antval_t ns[] = {0, 1, -1, 2, -2, 3, -3, 999, -999, LONG_MAX, LONG_MIN,
+                   LONG_MIN + 1, LONG_MAX - 1};
+  unsigned char out[100];
+  unsigned long rnd = 1;
+  size_t i, k, n;
+  antval_t m;
+  uint8_t flags;
+  for (i = 0; i < sizeof(ds) / sizeof(ds[0]); i++) {
+    if (!ant3_magic(ds[i], &m, &flags)) exit(1);
+    for (k = 0; k < sizeof(ns) / sizeof(ns[0]) + 1000; k++) {
+      antval_t x = k < sizeof(ns) / sizeof(ns[0]) ? ns[k] : (antval_t) rnd;
+      rnd = rnd * 6364136223846793005UL + 1442695040888963407UL;
+      if (ant3_divmagic(x, m, flags) != x / ds[i]) exit(1);
+    }
+  }
+  if (ant3_magic(0, &m, &flags) || ant3_magic(1, &m, &flags)) exit(1);
+  if (ant3_magic(-1, &m, &flags) || ant3_magic(LONG_MIN, &m, &flags)) exit(1);
+  n = ant3_divconst(&ant, code, out, sizeof(out));
+  if (n != sizeof(code) || out[7] != DivMagic) exit(1);
+  if (ant.imm[out[8]] == 3 || ant.imm[0] != 3 || ant.imm[1] != 1000) exit(1);
+  saved = ant;
+  if (ant3_eval(&saved, out) != 665667) exit(1);
+  saved = ant;
+  if (ant3_eval_tail(&saved, out) != 665667) exit(1);
+#if defined(__GNUC__) || defined(__clang__)
+  {
+    union ant3_cell cells[100];
+    saved = ant;
+    if (ant3_eval2(&saved, out) != 665667) exit(1);
+    saved = ant;
+    if (ant3_eval_tos(&saved, out) != 665667) exit(1);
+    saved = ant;
+    if (ant3_link(out, cells, 100) == 0) exit(1);
+    if (ant3_eval_linked(&saved, cells) != 665667) exit(1);
+  }
+#endif
+  checkjit(&ant, out, 665667);
+}
+
+static void test_ant3_verify(void) {
+  unsigned char code[] = {PushVar, 0,       PushVar, 1,         Plus, PushVar,
+                          1,       PushImm, 0,       Div,       Plus, PopVar,
+                          0,       IncVar,  1,       CmpVarImm, 1,    1,
+                          Jump,    0,       PushVar, 0,         Done};
+  unsigned char fused[] = {AddVarVar, 0, 1, DivVarImm,    1, 0, Plus,
+                           PopVar,    0, IncVar,          1, JumpVarNeImm,
+                           1,         1, 0xf5, 0xff,   PushVar, 0, Done};
+  unsigned char bad_op[] = {PushImm, 0, 200, Done};
+  unsigned char bad_var[] = {PushVar, ANT3_VARS, Done};
+  unsigned char bad_imm[] = {PushImm, 10, Done};
+  unsigned char bad_jump[] = {PushImm, 0, Jump, 1, Done};
+  unsigned char bad_jump2[] = {PushImm, 0, Jump, 10, Done};
+  unsigned char bad_depth[] = {PushImm, 0, PushImm, 0, Jump, 0, Done};
+  unsigned char underflow[] = {PushImm, 0, Plus, Done};
+  // A function body restores the caller's state, a stray Ret has none
+  unsigned char body[] = {PushI8, 5,    Func, 1,   11,  0,   Pick, 1,
+                          Pick,   2,    Plus, Ret, 1,   Pop, Done};
+  unsigned char stray_ret[] = {PushI8, 1, Ret, 0, Done};
+  unsigned char overflow[] = {PushImm, 0, PushImm, 0, PushImm, 0, PushImm,
+                              0,       PushImm, 0, PushImm, 0, PushImm, 0,
+                              PushImm, 0,       PushImm, 0, PushImm, 0,
+                              PushImm, 0,       Done};
+  if (ant3_verify(code, sizeof(code), NULL) != 3) exit(1);
+  if (ant3_verify(fused, sizeof(fused), NULL) != 2) exit(1);
+  if (ant3_verify(code, sizeof(code) - 1, NULL) != -1) exit(1);
+  if (ant3_verify(code, 8, NULL) != -1) exit(1);
+  if (ant3_verify(bad_op, sizeof(bad_op), NULL) != -1) exit(1);
+  if (ant3_verify(bad_var, sizeof(bad_var), NULL) != -1) exit(1);
+  if (ant3_verify(bad_imm, sizeof(bad_imm), NULL) != -1) exit(1);
+  if (ant3_verify(bad_jump, sizeof(bad_jump), NULL) != -1) exit(1);
+  if (ant3_verify(bad_jump2, sizeof(bad_jump2), NULL) != -1) exit(1);
+  if (ant3_verify(bad_depth, sizeof(bad_depth), NULL) != -1) exit(1);
+  if (ant3_verify(underflow, sizeof(underflow), NULL) != -1) exit(1);
+  if (ant3_verify(overflow, sizeof(overflow), NULL) != -1) exit(1);
+  if (ant3_verify(overflow + 2, sizeof(overflow) - 2, NULL) != 10) exit(1);
+  if (ant3_verify(body, sizeof(body), NULL) != 1) exit(1);
+  if (ant3_verify(stray_ret, sizeof(stray_ret), NULL) != -1) exit(1);
+}
+
+static void test_ant5(void) {
+  struct ant3 ant = {{3, 1000}, {0}, {0}, 0, 0};
+  struct ant5 ant5;
+  struct ant5_insn out[20];
+  unsigned char code[] = {AddVarVar, 0, 1, DivVarImm,    1, 0, Plus,
+                          PopVar,    0, IncVar,          1, JumpVarNeImm,
+                          1,         1, 0xf5, 0xff,   PushVar, 0, Done};
+  unsigned char bad[] = {Plus, Done};
+  unsigned char empty[] = {PushImm, 1, PushImm, 1, Plus, Pop, Done};
+  // res += i + i / 3 loop takes 5 instructions per iteration
+  if (ant5_compile(&ant5, &ant, code, out, 20) != 6) exit(1);
+  if (out[2].op != RAdd || out[2].d != ANT5_VAR(0)) exit(1);
+  if (out[4].op != RJne || out[4].d != 0) exit(1);
+  if (ant5_eval(&ant5, out) != 665667) exit(1);
+  if (ant5_compile(&ant5, &ant, code, out, 5) != 0) exit(1);
+  if (ant5_compile(&ant5, &ant, bad, out, 20) != 0) exit(1);
+  // Done with an empty stack returns 0
+  if (ant5_compile(&ant5, &ant, empty, out, 20) == 0) exit(1);
+  if (ant5_eval(&ant5, out) != 0) exit(1);
 }
 
 static void check4(const char *buf, antval_t expected) {
-  char tmp[200];
-  struct ant4 *ant = ant4_create(tmp, sizeof(tmp));
-  antval_t res = ant4_eval(ant, buf);
-  printf("[%s] \t=> %ld %ld\n", buf, res, expected);
-  if (res != expected) exit(1);
+  antval_t mem[128];
+  struct ant4 *ant = ant4_create(mem, sizeof(mem));
+  size_t n = ant4_compile(ant, buf);
+  antval_t res = ant4_exec(ant);
+  printf("[%s] \t=> %d bytes, %ld %ld\n", buf, (int) n, res, expected);
+  if (n == 0 || res != expected || ant4_exec(ant) != expected) exit(1);
 }
 
 static void test_ant4(void) {
-  // printf("%s %d\n", __func__, (int) ((char *) ant->estk - (char *) ant));
+  antval_t mem[32];
+  struct ant4 *ant = ant4_create(mem, sizeof(mem));
+  antval_t *count;
+  int i;
   check4("", 0);
   check4("0", 0);
   check4("17", 17);
   check4("1 + 2", 3);
   check4("1 + 2 + 3", 6);
   check4("1 + 2 + 3 * 4", 15);
+  check4("1 - 2 + 3", -4);
+  check4("(6 / (1 + 1)) * 3", 9);
+  check4("a + 1", 1);
+  check4("1;2", 2);
+  check4("b = c = 17; b + c", 34);
+  check4("b = 17; c = 1; b -= c", 16);
+  check4("b = 17; c = 1; c += b", 18);
+  check4("a = 1; b = 2; a == b", 0);
+  check4("a = 1; b = 2; a < b", 1);
+  check4("a = 1; b = 2; a > b", 0);
+  check4("a = 1; @f a; a = 7; # a", 1);
+  check4("a = 1; @f a == 0; a = 7; # a", 7);
+  check4("a = 1; @f a; @f 1; a = 7; # a", 1);
+  check4("a=0; i=0; # a += i; i += 1; @b i<10; a", 45);
+  check4("a=0; i=0; b=1; c=1000; # a += i+i/3; i += b; @b i<c; a", 665667);
+  check4("total = 0; n_1 = 0; # total += n_1; n_1 += 1; @b n_1 < 10; total",
+         45);
+  // Without a trailing expression, the last expression statement that ran
+  check4("a = 5; #", 5);
+  check4("a = 3; @f 0", 3);
+  check4("i = 0; # i += 1; @b i < 4", 4);
+  if (ant4_create(mem, 10) != NULL) exit(1);
+  if (ant4_compile(ant, "1 +") != 0 || ant->err == NULL) exit(1);
+  if (ant4_exec(ant) != 0 || ant4_eval(ant, "(1") != 0) exit(1);
+  if (ant4_compile(ant, "1+2+3+4+5+6+7+8+9+10+11+12+13+14+15+16") != 0 ||
+      strcmp(ant->err, "out of memory") != 0) {
+    exit(1);
+  }
+  // Variables keep their values between runs and are accessible to the host
+  ant = ant4_create(mem, sizeof(mem));
+  if (ant4_compile(ant, "count += 1") == 0) exit(1);
+  if (ant4_exec(ant) != 1 || ant4_exec(ant) != 2) exit(1);
+  if ((count = ant4_var(ant, "count")) == NULL || *count != 2) exit(1);
+  *count = 10;
+  if (ant4_exec(ant) != 11 || ant4_var(ant, "nope") != NULL) exit(1);
+  // Recompiling drops the literals of previous scripts, variables stay
+  ant = ant4_create(mem, sizeof(mem));
+  if (ant4_eval(ant, "a = 5; b = 7") != 7) exit(1);
+  for (i = 0; i < 100; i++) {
+    char src[30];
+    snprintf(src, sizeof(src), "x = a + b + %d", 1000 + i);
+    if (ant4_eval(ant, src) != 1012 + i) exit(1);
+  }
+  if ((count = ant4_var(ant, "x")) == NULL || *count != 1111) exit(1);
+}
+
+static void test_lexer(void) {
+  static const char ws[] = " \t\n\v\f\r";
+  char buf[100], src[120];
+  const char *p;
+  antval_t val = 0;
+  int i, n, c;
+  struct ant ant = ANT_INITIALIZER;
+  struct ant2 ant2 = ANT2_INITIALIZER;
+  // Runs of every length and at every alignment, stopping at any byte
+  for (n = 0; n < 70; n++) {
+    for (c = 0; c < 256; c++) {
+      memset(buf, 'x', sizeof(buf));
+      for (i = 0; i < n; i++) buf[i] = ws[(i + c) % 6];
+      buf[n] = (char) c;
+      p = ant_skip_space(buf, buf + n + 1);
+      if (p != buf + n + (isspace(c) ? 1 : 0)) exit(1);
+      if (ant_skip_space(buf, buf + n) != buf + n) exit(1);
+      if (!!ant_is(c, ANT_CSPACE) != !!isspace(c)) exit(1);
+      if (!!ant_is(c, ANT_CIDENT) != (isalnum(c) || c == '_')) exit(1);
+      if (!!ant_is(c, ANT_CHEX) != !!isxdigit(c)) exit(1);
+    }
+  }
+  // Tokens
+  p = "  x1 += 0x1f-=\t==\n= 7";
+  if (ant_lex(&p, p + strlen(p), ANT_CSTART, &val) != Var || *p != '1') exit(1);
+  p = ant_skip_ident(p, p + strlen(p));
+  if (ant_lex(&p, p + strlen(p), ANT_CSTART, &val) != Inc) exit(1);
+  if (ant_lex(&p, p + strlen(p), ANT_CSTART, &val) != Num || val != 31) exit(1);
+  if (ant_lex(&p, p + strlen(p), ANT_CSTART, &val) != Dec) exit(1);
+  if (ant_lex(&p, p + strlen(p), ANT_CSTART, &val) != Eq) exit(1);
+  if (ant_lex(&p, p + strlen(p), ANT_CSTART, &val) != '=') exit(1);
+  if (ant_lex(&p, p + strlen(p), ANT_CSTART, &val) != Num || val != 7) exit(1);
+  if (ant_lex(&p, p + strlen(p), ANT_CSTART, &val) != Eof || *p) exit(1);
+  // Long whitespace runs in every engine
+  memset(src, ' ', sizeof(src));
+  memcpy(src + 40, "a\n=\t3", 5);
+  memcpy(src + 80, ";\r\n2 * a", 9);
+  src[sizeof(src) - 1] = '\0';
+  check(&ant, src, 6, "");
+  check4(src, 6);
+  memset(src, ' ', sizeof(src));
+  memcpy(src + 50, "3 4 +", 5);
+  src[sizeof(src) - 1] = '\0';
+  check2(&ant2, src, 7);
+}
+
+static void check_num(const char *s) {
+  char *e1;
+  const char *e2;
+  antval_t v1 = (antval_t) strtoul(s, &e1, 0);
+  antval_t v2 = ant_num(s, s + strlen(s), &e2);
+  if (v1 != v2 || e1 != e2) {
+    printf("ant_num [%s]: %ld %ld, %d %d\n", s, v1, v2, (int) (e1 - s),
+           (int) (e2 - s));
+    exit(1);
+  }
+}
+
+static void test_ant_num(void) {
+  static const char *nums[] = {
+      "0", "7", "09", "0x", "0xg", "0X1f", "0x7fffffff+", "0777", "0778",
+      "4294967295", "4294967296", "18446744073709551615",
+      "18446744073709551616", "99999999999999999999", "0x10000000000000000",
+      "0xffffffffffffffff", "0x00000000000000000000001", "12345678",
+      "123456789012345678", "1234567890123456789", "07777777777777777777777",
+      "0000000000000000000000000000000012", "100000000 ", "1234;5"};
+  char buf[40];
+  unsigned i, n, seed = 1;
+  struct ant2 ant2 = ANT2_INITIALIZER;
+  for (i = 0; i < sizeof(nums) / sizeof(nums[0]); i++) check_num(nums[i]);
+  // Random digit strings of every length, in each base
+  for (i = 0; i < 3000; i++) {
+    const char *pfx = i % 3 == 0 ? "0x" : i % 3 == 1 ? "0" : "";
+    size_t len = strlen(pfx);
+    memcpy(buf, pfx, len);
+    for (n = 0; n < i % 30; n++) {
+      seed = seed * 1103515245 + 12345;
+      buf[len++] = "0123456789abcdef"[(seed >> 16) % (i % 3 == 0 ? 16 : 10)];
+    }
+    if (len == 0 || (buf[0] == '0' && i % 3 == 2)) buf[0] = '1';
+    if (len == 0) len = 1;
+    buf[len] = "+ x;9"[i % 5];
+    buf[len + 1] = '\0';
+    check_num(buf);
+  }
+  check2(&ant2, "0x10 010 + 123456789 +", 123456813);
+}
+
+// A long run through the tail call handlers must not grow the native stack
+static void test_ant3_tail(void) {
+#if defined(ANT3_MUSTTAIL) && defined(__OPTIMIZE__)
+  const char *src = "a=0; i=0; c=1000000; # a += 1; i += 1; @b i<c; a";
+  struct ant3 vm = {{0}, {0}, {0}, 0, 0};
+  uint8_t code[64];
+  if (ant_compile(src, code, sizeof(code), &vm) == 0) exit(1);
+  if (ant3_eval_tail(&vm, code) != 1000000) exit(1);
+#endif
+}
+
+// Generated programs give the same result on every engine
+static void test_gen(void) {
+  static char infix[12000], postfix[12000];
+  static uint8_t code[12000], code2[12000];
+  static antval_t mem[512];
+  struct gen_out o = {infix, postfix, code, sizeof(infix), sizeof(postfix),
+                      sizeof(code), 0, 0, 0, 0, 0};
+  struct gen g = {1, 300, 0, 1, 3};
+  struct ant ant = ANT_INITIALIZER;
+  struct ant2 ant2 = ANT2_INITIALIZER;
+  struct ant3 vm;
+  struct ant4 *ant4;
+  antval_t res;
+  for (g.seed = 1; g.seed < 40; g.seed++) {
+    g.depth = (int) g.seed % 4, g.nvars = 1 + (int) g.seed % 9;
+    if (!gen_program(&g, &o)) exit(1);
+    ant4 = ant4_create(mem, sizeof(mem));  // Fresh symbol table
+    memset(&vm, 0, sizeof(vm));
+    res = ant3_eval(&vm, code);
+    if (ant3_verify(code, o.clen, NULL) < 0 ||
+        ant_eval(&ant, infix) != res || ant.err[0] != '\0' ||
+        ant2_eval(&ant2, postfix) != res ||
+        ant2.sp != 1 || ant4_eval(ant4, infix) != res) {
+      printf("gen %u: [%s] [%s] %ld\n", g.seed, infix, postfix, res);
+      exit(1);
+    }
+    memset(&vm, 0, sizeof(vm));
+    if (ant_compile(infix, code2, sizeof(code2), &vm) == 0 ||
+        ant3_eval2(&vm, code2) != res) {
+      exit(1);
+    }
+    memset(&vm, 0, sizeof(vm));
+    if (ant2_compile(postfix, code2, sizeof(code2), &vm) == 0 ||
+        ant3_eval_tos(&vm, code2) != res) {
+      exit(1);
+    }
+    memset(&vm, 0, sizeof(vm));
+    if (ant3_optimize(&vm, code, code2, o.clen, NULL) == 0 ||
+        ant3_eval(&vm, code2) != res) {
+      exit(1);
+    }
+    checkjit(&vm, code2, res);
+  }
+  // Rewriting passes take linear time, so a 10 KB program is quick
+  g.seed = 7, g.size = 10000, g.depth = 2, g.nvars = 8;
+  if (!gen_program(&g, &o)) exit(1);
+  memset(&vm, 0, sizeof(vm));
+  res = ant3_eval(&vm, code);
+  memset(&vm, 0, sizeof(vm));
+  if (ant3_optimize(&vm, code, code2, o.clen, NULL) == 0 ||
+      ant3_eval(&vm, code2) != res) {
+    exit(1);
+  }
+  memset(&vm, 0, sizeof(vm));
+  if (ant3_fuse(&vm, code, code2, sizeof(code2)) == 0 ||
+      ant3_eval(&vm, code2) != res) {
+    exit(1);
+  }
+  checkjit(&vm, code2, res);
+  // Buffers that are too small and bad parameters
+  o.isize = 50;
+  if (gen_program(&g, &o)) exit(1);
+  o.isize = sizeof(infix), g.count = 0;
+  if (gen_program(&g, &o)) exit(1);
 }
 
 int main(void) {
   test_ant();
   test_ant2();
   test_ant3();
+  test_ant_compile();
+  test_ant_vars();
+  test_ant2_compile();
+  test_ant3_pushi();
+  test_ant3_native();
+  test_ant3_calls();
+  test_ant3_jumps();
+  test_ant3_fuse();
+  test_ant3_optimize();
+  test_ant3_divconst();
+  test_ant3_verify();
+  test_ant3_tail();
+  test_ant5();
   test_ant4();
+  test_lexer();
+  test_ant_num();
+  test_gen();
   return 0;
 }